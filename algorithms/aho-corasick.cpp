@@ -5,179 +5,1823 @@
  * Время работы - O(n + m + Z), где Z - общее -число
  * вхождений подстрок шаблона “между вопросиками” в исходном тексте.
  */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
 #include <array>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <queue>
 #include <string>
+#include <thread>
 #include <vector>
 
 
-struct Node {
-    std::vector<int> next_states_;
-    std::vector<int> delta_;
-    std::vector<int> lines_;
-    bool is_leaf_;
-    int parent_;
-    int state_by_char_;
-    int suf_link_;
-    int up_link_;
-    explicit Node(int n) : is_leaf_(false), parent_(0), state_by_char_(0), suf_link_(-1), up_link_(-1) {
-        next_states_.assign(n, -1);
-        delta_.assign(n, -1);
-    };
+/* Режим построения автомата.
+ * kLazy - переходы, суффиксные ссылки и ссылки на выходы вычисляются рекурсивно при первом обращении:
+ * построение за O(m), подходит для огромных шаблонов, по которым ищут один раз.
+ * kEager - все таблицы заполняются обходом в ширину при построении, поиск делает
+ * одно обращение к таблице на символ текста без рекурсии и проверок на -1.
+ */
+enum class BuildMode {
+    kLazy,
+    kEager
+};
+
+/* Политики алфавита: Size() - число классов символов (ширина строки таблицы переходов),
+ * Index(c) - класс байта c. Байты текста вне алфавита попадают в отдельный класс "прочие",
+ * поэтому любой текст обрабатывается без выхода за границы таблицы.
+ * Build вызывается с шаблоном до построения автомата и возвращает false, если в шаблоне
+ * (кроме вопросиков) есть байт вне алфавита: иначе он попал бы в класс "прочие" и совпадал бы
+ * с любым другим байтом вне алфавита. Так класс "прочие" не встречается ни на одном ребре бора.
+ */
+struct LowercaseAlphabet {
+    bool Build(const std::string & pattern) {
+        for (char character : pattern) {
+            if (character != '?' && Index(character) == 26)
+                return false;
+        }
+        return true;
+    }
+    int Size() const {
+        return 27;
+    }
+    int Index(unsigned char c) const {
+        return (c >= 'a' && c <= 'z') ? c - 'a' : 26;
+    }
+};
+
+struct AsciiAlphabet {
+    bool Build(const std::string & pattern) {
+        for (char character : pattern) {
+            if (Index(character) == 128)
+                return false;
+        }
+        return true;
+    }
+    int Size() const {
+        return 129;
+    }
+    int Index(unsigned char c) const {
+        return c < 128 ? c : 128;
+    }
+};
+
+struct ByteAlphabet {
+    bool Build(const std::string &) {
+        return true;
+    }
+    int Size() const {
+        return 256;
+    }
+    int Index(unsigned char c) const {
+        return c;
+    }
+};
+
+/* Сжатый алфавит: по классу на каждый байт, встречающийся в шаблоне, и класс 0 для всех остальных.
+ * Строка таблицы переходов получается не шире числа различных символов шаблона.
+ */
+class CompressedAlphabet {
+public:
+    bool Build(const std::string & pattern) {
+        classes_.fill(0);
+        size_ = 1;
+        for (char character : pattern) {
+            auto c = static_cast<unsigned char>(character);
+            if (character != '?' && classes_[c] == 0)
+                classes_[c] = size_++;
+        }
+        return true;
+    }
+    int Size() const {
+        return size_;
+    }
+    int Index(unsigned char c) const {
+        return classes_[c];
+    }
+
+private:
+    std::array<uint8_t, 256> classes_{};
+    int size_ = 1;
+};
+
+/* Файл, целиком отображенный в память только для чтения. Страницы подгружает и вытесняет ядро,
+ * так что файл может быть больше оперативной памяти.
+ * Если trim_whitespace, завершающие пробельные символы (перевод строки) в текст не входят.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const char* path, bool trim_whitespace = true);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    bool IsOpen() const {
+        return is_open_;
+    }
+    const char* Data() const {
+        return data_;
+    }
+    std::size_t Size() const {
+        return length_;
+    }
+
+private:
+    const char* data_;
+    std::size_t length_;
+    std::size_t mapped_length_;
+    bool is_open_;
+};
+
+/* Заголовок снимка построенного автомата. За ним без промежутков идут 256 байт классов символов
+ * и массивы int32: delta[states * power], up_link[states], line_begin[states + 1], lines[line_count],
+ * line_pattern[line_count], pattern_lengths[patterns], chunk_begin[patterns + 1].
+ * Все поля выровнены на 4 байта, порядок байт - родной для машины.
+ */
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t power;
+    int32_t states;
+    int32_t line_count;
+    int32_t patterns;
+    int32_t pattern_length;
+};
+
+static const char kSnapshotMagic[8] = {'A', 'C', 'S', 'N', 'A', 'P', '\0', '\0'};
+static const uint32_t kSnapshotVersion = 2;
+
+// Вхождение шаблона с номером pattern, начинающееся в позиции position текста.
+struct WildcardMatch {
+    int pattern;
+    std::size_t position;
 };
 
+template <class Alphabet>
+class StreamingSearcher;
+
+/* Автомат строится по набору шаблонов сразу: подстроки "между вопросиками" всех шаблонов
+ * попадают в общий бор, каждое смещение в lines_ помечено номером своего шаблона, поэтому
+ * один проход по тексту находит вхождения всех шаблонов.
+ */
+template <class Alphabet = LowercaseAlphabet>
 class AhoCorasick {
 public:
-    explicit AhoCorasick(const std::string & pattern) {
-        last_ = 0;
-        power_ = 26;
-        Prepare(pattern);
-        pattern_length_ = pattern.length();
-        Node root(power_);
-        nodes_.push_back(root);
+    explicit AhoCorasick(const std::string & pattern, BuildMode mode = BuildMode::kEager)
+            : AhoCorasick(std::vector<std::string>(1, pattern), mode) {}
+
+    explicit AhoCorasick(const std::vector<std::string> & patterns, BuildMode mode = BuildMode::kEager)
+            : mode_(mode) {
+        std::string all_patterns;
+        for (const std::string & pattern : patterns)
+            all_patterns += pattern;
+        valid_ = alphabet_.Build(all_patterns);
+        power_ = alphabet_.Size();
+        pattern_length_ = 0;
+        for (int id = 0; id < static_cast<int>(patterns.size()); ++id) {
+            chunk_begin_.push_back(string_vector.size());
+            Prepare(patterns[id], id);
+            pattern_lengths_.push_back(patterns[id].length());
+            pattern_length_ = std::max<int>(pattern_length_, patterns[id].length());
+        }
+        chunk_begin_.push_back(string_vector.size());
+        AddState(0, 0);
 
-        last_ = 1;
-        for (int i = 0; i < string_vector.size(); ++i) {
-            AddString(string_vector[i], i);
+        for (int i = 0; i < static_cast<int>(string_vector.size()); ++i) {
+            AddString(string_vector[i]);
         }
+        BuildLineIndex();
+        if (mode_ == BuildMode::kEager) {
+            BuildEager();
+        }
+        classes_.resize(256);
+        for (int c = 0; c < 256; ++c)
+            classes_[c] = alphabet_.Index(c);
+        RefreshTables();
+    }
+
+    AhoCorasick(const AhoCorasick&) = delete;
+    AhoCorasick& operator = (const AhoCorasick&) = delete;
+
+    // false, если в шаблонах есть байты вне алфавита; такой автомат ничего не находит и не сохраняется.
+    bool IsValid() const {
+        return valid_;
+    }
+
+    // Объем таблиц, по которым идет поиск (столько же занимает снимок без заголовка).
+    std::size_t TableBytes() const {
+        std::size_t cells = static_cast<std::size_t>(tables_.states) * (power_ + 2) + 1 +
+                            static_cast<std::size_t>(tables_.line_count) * 2 + static_cast<std::size_t>(tables_.patterns) * 2 + 1;
+        return 256 + cells * sizeof(int32_t);
     }
 
+    /* Снимок автомата: пишется один раз, а при загрузке файл отображается в память, и поиск идет
+     * прямо по его таблицам, без разбора и выделения памяти под автомат. Загрузка возвращает
+     * nullptr, если файл не читается, не является снимком этой версии или его таблицы не проходят
+     * проверку границ (CheckTables).
+     * Загруженный автомат поддерживает поиск автоматом, PrefilterSearch сводится к нему же.
+     */
+    bool SaveSnapshot(const char* path);
+    static std::unique_ptr<AhoCorasick> LoadSnapshot(const char* path);
+
     void StringSearch(const std::string& text);
+    void ParallelStringSearch(const char* text, std::size_t length, unsigned int threads);
+    void PrefilterSearch(const char* text, std::size_t length, bool vectorized = true);
     void PrintAnswer() {
-        for (int i : answer_)
-            std::cout << i << " ";
+        // Для одного шаблона печатаются только позиции, для набора - пары "шаблон:позиция".
+        for (const WildcardMatch & match : answer_) {
+            if (PatternCount() > 1)
+                std::cout << match.pattern << ":";
+            std::cout << match.position << " ";
+        }
     }
 
 private:
     std::vector <std::string> string_vector;
     std::vector <int> starts_;
-    std::vector<Node> nodes_;
-    std::vector<int> answer_;
+    // Номер шаблона каждой подстроки; подстроки шаблона id лежат в [chunk_begin_[id], chunk_begin_[id + 1]).
+    std::vector <int> chunk_pattern_;
+    std::vector <int32_t> chunk_begin_;
+    std::vector <int32_t> pattern_lengths_;
+    /* Автомат хранится плоскими массивами (struct-of-arrays): переход из состояния state
+     * по символу a лежит в ячейке state * power_ + a, поля вершин - в отдельных массивах.
+     */
+    std::vector<int32_t> next_states_;
+    std::vector<int32_t> delta_;
+    std::vector<int32_t> parent_;
+    std::vector<int32_t> state_by_char_;
+    std::vector<int32_t> suf_link_;
+    std::vector<int32_t> up_link_;
+    /* Выходы листьев: смещения состояния state лежат подряд в lines_[line_begin_[state]..line_begin_[state + 1]),
+     * так что поиск читает их одним отрезком. Пока строится бор, line_state_ хранит для каждой подстроки
+     * состояние, в котором она кончается; BuildLineIndex раскладывает смещения по состояниям.
+     */
+    std::vector<int32_t> line_state_;
+    std::vector<int32_t> line_begin_;
+    std::vector<int32_t> lines_;
+    std::vector<int32_t> line_pattern_;
+    std::vector<uint8_t> classes_;
+    /* Таблицы, по которым идет поиск. Указывают в массивы выше или, если автомат загружен
+     * из снимка, прямо в отображенный в память файл snapshot_.
+     */
+    struct Tables {
+        const uint8_t* classes;
+        const int32_t* delta;
+        const int32_t* up_link;
+        const int32_t* line_begin;
+        const int32_t* lines;
+        const int32_t* line_pattern;
+        const int32_t* pattern_lengths;
+        const int32_t* chunk_begin;
+        int32_t states;
+        int32_t line_count;
+        int32_t patterns;
+    };
+    Tables tables_;
+    std::unique_ptr<MappedFile> snapshot_;
+    std::vector<WildcardMatch> answer_;
+    Alphabet alphabet_;
     int power_;
+    // Длина самого длинного шаблона.
     int pattern_length_;
-    unsigned int last_;
+    BuildMode mode_;
+    bool valid_;
+
+    AhoCorasick() : power_(0), pattern_length_(0), mode_(BuildMode::kEager), valid_(true) {}
+
+    bool IsLeaf(int state) const {
+        return line_begin_[state] != line_begin_[state + 1];
+    }
+
+    int PatternCount() const {
+        return tables_.patterns;
+    }
+
+    int PatternLength(int pattern) const {
+        return tables_.pattern_lengths[pattern];
+    }
 
-    void Prepare(const std::string & text);
-    void AddString(const std::string & text, int ind);
+    int ChunkCount(int pattern) const {
+        return tables_.chunk_begin[pattern + 1] - tables_.chunk_begin[pattern];
+    }
+
+    static bool CheckTables(const Tables &tables, int power, int pattern_length);
+
+    void RefreshTables();
+    int AddState(int parent, int state_by_char);
+    bool MatchesAt(const char* text, std::size_t position, int pattern) const;
+    void PrefilterPattern(const char* text, std::size_t length, int pattern, bool vectorized);
+    void Prepare(const std::string & text, int pattern);
+    void AddString(const std::string & text);
+    void BuildLineIndex();
+    void BuildEager();
     int GetSuffLink(int state);
     int GetUpLink(int state);
     int GetDelta(int state, int a);
+
+    friend class StreamingSearcher<Alphabet>;
+};
+
+/* Потоковый поиск: текст подается кусками произвольной длины, вхождения сообщаются через report
+ * сразу, как только прочитано все окно шаблона. Вместо массива счетчиков длины текста для каждого
+ * шаблона хранится кольцевой буфер счетчиков длиной в его длину, округленную вверх до степени двойки
+ * (номер ячейки - маска, а не деление), поэтому память не зависит от длины текста.
+ * Ячейка кольца помечена позицией, которой она сейчас принадлежит, и обнуляется при первом
+ * обращении от новой позиции, так что работа на символ не растет с числом шаблонов.
+ */
+template <class Alphabet>
+class StreamingSearcher {
+public:
+    using MatchCallback = std::function<void(std::size_t)>;
+    using MultiMatchCallback = std::function<void(int, std::size_t)>;
+
+    StreamingSearcher(AhoCorasick<Alphabet>& automaton, MatchCallback report);
+    StreamingSearcher(AhoCorasick<Alphabet>& automaton, MultiMatchCallback report);
+    void Feed(const char* data, std::size_t length);
+
+private:
+    // Найденное вхождение, о котором можно сообщить, когда будет прочитан символ due.
+    struct Pending {
+        std::size_t due;
+        int pattern;
+        std::size_t position;
+        bool operator > (const Pending& other) const {
+            return due > other.due || (due == other.due && pattern > other.pattern);
+        }
+    };
+
+    AhoCorasick<Alphabet>& automaton_;
+    MultiMatchCallback report_;
+    // Счетчик подстрок, найденных для начала шаблона в позиции position - 1 (0 - ячейка свободна).
+    struct Counter {
+        std::size_t position;
+        int count;
+    };
+
+    std::vector<Counter> counters_;
+    std::vector<int> ring_begin_;
+    std::vector<std::size_t> ring_mask_;
+    std::vector<int> chunk_count_;
+    std::vector<int> wildcard_only_;
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending> > pending_;
+    int state_;
+    std::size_t position_;
+
+    template <bool kEager>
+    void Scan(const char* data, std::size_t length);
+};
+
+/* Битово-параллельный поиск Shift-And для шаблонов длины до 64 * Words: бит k состояния означает,
+ * что последние k + 1 символов текста совпадают с первыми k + 1 символами шаблона. На каждый байт
+ * текста - один сдвиг и одно "и" с маской символа, без бора и массива счетчиков. Вопросику в маске
+ * каждого символа соответствует единица. При Words = 2 (шаблоны до 128 символов) состояние -
+ * два слова в регистрах общего назначения со сдвигом и переносом по словам: перенос между
+ * полосами векторного регистра удлиняет цепочку зависимостей на байт, и SSE2 здесь медленнее.
+ * При Words = 4 (до 256 символов) состояние держится в регистре AVX2 (без AVX2 - в паре регистров
+ * SSE2): сдвиг идет по 64-битным полосам, старший бит каждой полосы переставляется в младший бит
+ * следующей. Без SSE2, а также при остальных Words (WildcardSearcher берет еще Words = 5 для шаблонов
+ * до 320 символов) сдвиг идет по словам.
+ */
+template <int Words>
+class ShiftAndSearcher {
+public:
+    using MatchCallback = std::function<void(std::size_t)>;
+
+    ShiftAndSearcher(const std::string& pattern, MatchCallback report);
+    void Feed(const char* data, std::size_t length);
+
+private:
+    using Bits = std::array<uint64_t, Words>;
+
+    std::vector<Bits> masks_;
+    Bits state_;
+    // Единственный бит last_bit_ в слове last_word_: по нему векторный Feed<4> проверяет вхождение.
+    Bits last_;
+    int last_word_;
+    uint64_t last_bit_;
+    int pattern_length_;
+    std::size_t position_;
+    MatchCallback report_;
+};
+
+/* Единый интерфейс поиска по шаблону с вопросиками: для шаблонов не длиннее 320 символов
+ * выбирается ShiftAndSearcher, для более длинных - автомат Ахо-Корасик. Порог взят из секции
+ * shift-and в --bench: до 320 символов Shift-And быстрее, на 384 - то так, то так, с 448 выигрывает автомат.
+ */
+class WildcardSearcher {
+public:
+    using MatchCallback = std::function<void(std::size_t)>;
+
+    WildcardSearcher(const std::string& pattern, MatchCallback report);
+    void Feed(const char* data, std::size_t length) {
+        engine_->Feed(data, length);
+    }
+
+private:
+    struct Engine {
+        virtual ~Engine() = default;
+        virtual void Feed(const char* data, std::size_t length) = 0;
+    };
+
+    template <int Words>
+    struct ShiftAndEngine : Engine {
+        ShiftAndSearcher<Words> searcher;
+        ShiftAndEngine(const std::string& pattern, MatchCallback report) : searcher(pattern, std::move(report)) {}
+        void Feed(const char* data, std::size_t length) override {
+            searcher.Feed(data, length);
+        }
+    };
+
+    struct AutomatonEngine : Engine {
+        AhoCorasick<CompressedAlphabet> automaton;
+        StreamingSearcher<CompressedAlphabet> searcher;
+        AutomatonEngine(const std::string& pattern, MatchCallback report)
+                : automaton(pattern), searcher(automaton, std::move(report)) {}
+        void Feed(const char* data, std::size_t length) override {
+            searcher.Feed(data, length);
+        }
+    };
+
+    std::unique_ptr<Engine> engine_;
 };
 
-int main() {
+template <class Searcher>
+bool SearchMappedFile(const char* path, Searcher& searcher);
+
+// Больше потоков, чем kMaxThreadsPerCore на ядро, поиску не нужно.
+static const unsigned int kMaxThreadsPerCore = 4;
+
+bool ParseThreads(const char* text, unsigned int& threads);
+
+int RunBenchmarks(std::size_t text_size, unsigned int threads);
+
+int main(int argc, char* argv[]) {
+    /* Снимок автомата: "--save snapshot" строит автомат по шаблону из стандартного ввода и сохраняет его,
+     * "--load snapshot text [threads]" ищет по готовому снимку в файле text, не перестраивая автомат.
+     * "--bench [megabytes] [threads]" - замеры на синтетическом тексте (RunBenchmarks), ввод не читается.
+     */
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        long megabytes = argc > 2 ? std::strtol(argv[2], nullptr, 10) : 20;
+        unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+        if (megabytes < 1 || (argc > 3 && !ParseThreads(argv[3], threads))) {
+            std::cerr << "Usage: --bench [megabytes] [threads]" << std::endl;
+            return 1;
+        }
+        return RunBenchmarks(static_cast<std::size_t>(megabytes) << 20, threads);
+    }
+
+    if (argc > 3 && std::string(argv[1]) == "--load") {
+        std::unique_ptr<AhoCorasick<CompressedAlphabet> > example =
+                AhoCorasick<CompressedAlphabet>::LoadSnapshot(argv[2]);
+        if (!example) {
+            std::cerr << "Cannot load snapshot " << argv[2] << std::endl;
+            return 1;
+        }
+        MappedFile file(argv[3]);
+        if (!file.IsOpen()) {
+            std::cerr << "Cannot read " << argv[3] << std::endl;
+            return 1;
+        }
+        unsigned int threads = 1;
+        if (argc > 4 && !ParseThreads(argv[4], threads)) {
+            std::cerr << "Bad thread count " << argv[4] << std::endl;
+            return 1;
+        }
+        example->ParallelStringSearch(file.Data(), file.Size(), threads);
+        example->PrintAnswer();
+        return 0;
+    }
+
     std::string pattern;
     std::cin >> pattern;
 
-    AhoCorasick example(pattern);
+    if (argc > 2 && std::string(argv[1]) == "--save") {
+        AhoCorasick<CompressedAlphabet> example(pattern);
+        if (!example.SaveSnapshot(argv[2])) {
+            std::cerr << "Cannot write " << argv[2] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    /* Если передан путь к файлу, текст берется из него через mmap, без копирования.
+     * Вторым аргументом можно задать число потоков поиска.
+     */
+    if (argc > 2) {
+        unsigned int threads;
+        if (!ParseThreads(argv[2], threads)) {
+            std::cerr << "Bad thread count " << argv[2] << std::endl;
+            return 1;
+        }
+        MappedFile file(argv[1]);
+        if (!file.IsOpen()) {
+            std::cerr << "Cannot read " << argv[1] << std::endl;
+            return 1;
+        }
+        AhoCorasick<CompressedAlphabet> example(pattern);
+        example.ParallelStringSearch(file.Data(), file.Size(), threads);
+        example.PrintAnswer();
+        return 0;
+    }
 
-    std::string text;
-    std::cin >> text;
-    example.StringSearch(text);
-    example.PrintAnswer();
+    WildcardSearcher searcher(pattern, [](std::size_t position) {
+        std::cout << position << " ";
+    });
+    if (argc > 1) {
+        if (!SearchMappedFile(argv[1], searcher)) {
+            std::cerr << "Cannot read " << argv[1] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Текст читается блоками до первого пробельного символа и целиком в памяти не хранится.
+    std::vector<char> buffer(1 << 16);
+    std::cin >> std::ws;
+    while (std::cin) {
+        std::cin.read(buffer.data(), buffer.size());
+        std::size_t length = std::cin.gcount();
+        std::size_t end = 0;
+        while (end < length && !std::isspace(static_cast<unsigned char>(buffer[end])))
+            ++end;
+        searcher.Feed(buffer.data(), end);
+        if (end < length)
+            break;
+    }
     return 0;
 }
 
-void AhoCorasick::StringSearch(const std::string &text) {
-    if (text.length() < pattern_length_)
+template <class Alphabet>
+void AhoCorasick<Alphabet>::StringSearch(const std::string &text) {
+    StreamingSearcher<Alphabet> searcher(*this, [this](int pattern, std::size_t position) {
+        answer_.push_back({pattern, position});
+    });
+    searcher.Feed(text.data(), text.length());
+}
+
+template <class Alphabet>
+void AhoCorasick<Alphabet>::RefreshTables() {
+    tables_.classes = classes_.data();
+    tables_.delta = delta_.data();
+    tables_.up_link = up_link_.data();
+    tables_.line_begin = line_begin_.data();
+    tables_.lines = lines_.data();
+    tables_.line_pattern = line_pattern_.data();
+    tables_.pattern_lengths = pattern_lengths_.data();
+    tables_.chunk_begin = chunk_begin_.data();
+    tables_.states = parent_.size();
+    tables_.line_count = lines_.size();
+    tables_.patterns = pattern_lengths_.size();
+}
+
+template <class Alphabet>
+bool AhoCorasick<Alphabet>::SaveSnapshot(const char *path) {
+    if (!valid_)
+        return false;
+    if (mode_ == BuildMode::kLazy) {
+        BuildEager();
+        mode_ = BuildMode::kEager;
+    }
+    SnapshotHeader header;
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.version = kSnapshotVersion;
+    header.power = power_;
+    header.states = tables_.states;
+    header.line_count = tables_.line_count;
+    header.patterns = tables_.patterns;
+    header.pattern_length = pattern_length_;
+
+    std::ofstream out(path, std::ios::binary);
+    auto write = [&out](const void *data, std::size_t size) {
+        out.write(static_cast<const char *>(data), size);
+    };
+    write(&header, sizeof(header));
+    write(tables_.classes, 256);
+    write(tables_.delta, sizeof(int32_t) * header.states * header.power);
+    write(tables_.up_link, sizeof(int32_t) * header.states);
+    write(tables_.line_begin, sizeof(int32_t) * (static_cast<std::size_t>(header.states) + 1));
+    write(tables_.lines, sizeof(int32_t) * header.line_count);
+    write(tables_.line_pattern, sizeof(int32_t) * header.line_count);
+    write(tables_.pattern_lengths, sizeof(int32_t) * header.patterns);
+    write(tables_.chunk_begin, sizeof(int32_t) * (static_cast<std::size_t>(header.patterns) + 1));
+    return static_cast<bool>(out);
+}
+
+template <class Alphabet>
+std::unique_ptr<AhoCorasick<Alphabet> > AhoCorasick<Alphabet>::LoadSnapshot(const char *path) {
+    std::unique_ptr<MappedFile> file(new MappedFile(path, false));
+    if (!file->IsOpen() || file->Size() < sizeof(SnapshotHeader) + 256)
+        return nullptr;
+    SnapshotHeader header;
+    std::memcpy(&header, file->Data(), sizeof(header));
+    if (std::memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 || header.version != kSnapshotVersion)
+        return nullptr;
+    if (header.power <= 0 || header.power > 256 || header.states <= 0 || header.line_count < 0 || header.patterns <= 0)
+        return nullptr;
+    /* Размеры из заголовка не доверенные: каждый сначала сравнивается с числом ячеек в файле
+     * делением, и только потом размеры перемножаются и складываются в std::size_t.
+     */
+    std::size_t payload = file->Size() - sizeof(header) - 256;
+    std::size_t available = payload / sizeof(int32_t);
+    std::size_t power = header.power;
+    std::size_t states = header.states;
+    std::size_t line_count = header.line_count;
+    std::size_t patterns = header.patterns;
+    if (payload % sizeof(int32_t) != 0 || states > available / (power + 2) || line_count > available / 2 ||
+        patterns > available / 2)
+        return nullptr;
+    if (states * (power + 2) + line_count * 2 + patterns * 2 + 2 != available)
+        return nullptr;
+
+    std::unique_ptr<AhoCorasick> automaton(new AhoCorasick());
+    automaton->power_ = header.power;
+    automaton->pattern_length_ = header.pattern_length;
+    Tables &tables = automaton->tables_;
+    const char *data = file->Data() + sizeof(header);
+    tables.classes = reinterpret_cast<const uint8_t *>(data);
+    const int32_t *cell = reinterpret_cast<const int32_t *>(data + 256);
+    auto take = [&cell](std::size_t count) {
+        const int32_t *result = cell;
+        cell += count;
+        return result;
+    };
+    tables.delta = take(states * power);
+    tables.up_link = take(states);
+    tables.line_begin = take(states + 1);
+    tables.lines = take(line_count);
+    tables.line_pattern = take(line_count);
+    tables.pattern_lengths = take(patterns);
+    tables.chunk_begin = take(patterns + 1);
+    tables.states = header.states;
+    tables.line_count = header.line_count;
+    tables.patterns = header.patterns;
+    if (!CheckTables(tables, header.power, header.pattern_length))
+        return nullptr;
+    automaton->snapshot_ = std::move(file);
+    return automaton;
+}
+
+template <class Alphabet>
+bool AhoCorasick<Alphabet>::CheckTables(const Tables &tables, int power, int pattern_length) {
+    /* Один проход по отображенным массивам за O(states * power + line_count + patterns): каждое
+     * значение, которым поиск индексирует другой массив, лежит в границах, отрезки смещений
+     * состояний не выходят за lines, а цепочки, по которым поиск идет циклом до конца, конечны.
+     * Иначе испорченный снимок читал бы мимо файла или зацикливал Scan.
+     */
+    std::size_t cells = static_cast<std::size_t>(tables.states) * power;
+    for (int c = 0; c < 256; ++c) {
+        if (tables.classes[c] >= power)
+            return false;
+    }
+    for (std::size_t cell = 0; cell < cells; ++cell) {
+        if (tables.delta[cell] < 0 || tables.delta[cell] >= tables.states)
+            return false;
+    }
+    // Цепочка выходов от любого состояния должна дойти до корня: 0 - не пройдено, 1 - в текущей цепочке, 2 - ведет в корень.
+    std::vector<uint8_t> color(tables.states, 0);
+    color[0] = 2;
+    std::vector<int32_t> chain;
+    for (int32_t state = 0; state < tables.states; ++state) {
+        int32_t current = state;
+        while (color[current] == 0) {
+            color[current] = 1;
+            chain.push_back(current);
+            current = tables.up_link[current];
+            if (current < 0 || current >= tables.states)
+                return false;
+        }
+        if (color[current] == 1)
+            return false;
+        for (int32_t visited : chain)
+            color[visited] = 2;
+        chain.clear();
+    }
+    if (tables.line_begin[0] != 0 || tables.line_begin[tables.states] != tables.line_count)
+        return false;
+    for (int32_t state = 0; state < tables.states; ++state) {
+        if (tables.line_begin[state + 1] < tables.line_begin[state])
+            return false;
+    }
+    int longest = 0;
+    for (int32_t pattern = 0; pattern < tables.patterns; ++pattern) {
+        if (tables.pattern_lengths[pattern] < 0)
+            return false;
+        longest = std::max(longest, tables.pattern_lengths[pattern]);
+    }
+    if (longest != pattern_length)
+        return false;
+    if (tables.chunk_begin[0] != 0 || tables.chunk_begin[tables.patterns] != tables.line_count)
+        return false;
+    for (int32_t pattern = 0; pattern < tables.patterns; ++pattern) {
+        if (tables.chunk_begin[pattern + 1] < tables.chunk_begin[pattern])
+            return false;
+    }
+    // У каждого шаблона столько смещений, сколько у него подстрок, и все они внутри его окна.
+    std::vector<int32_t> chunks(tables.patterns, 0);
+    for (int32_t line = 0; line < tables.line_count; ++line) {
+        int32_t pattern = tables.line_pattern[line];
+        if (pattern < 0 || pattern >= tables.patterns)
+            return false;
+        if (tables.lines[line] < 1 || tables.lines[line] > tables.pattern_lengths[pattern])
+            return false;
+        ++chunks[pattern];
+    }
+    for (int32_t pattern = 0; pattern < tables.patterns; ++pattern) {
+        if (chunks[pattern] != tables.chunk_begin[pattern + 1] - tables.chunk_begin[pattern])
+            return false;
+    }
+    return true;
+}
+
+template <class Alphabet>
+StreamingSearcher<Alphabet>::StreamingSearcher(AhoCorasick<Alphabet> &automaton, MatchCallback report)
+        : StreamingSearcher(automaton, MultiMatchCallback([report](int, std::size_t position) {
+              report(position);
+          })) {}
+
+template <class Alphabet>
+StreamingSearcher<Alphabet>::StreamingSearcher(AhoCorasick<Alphabet> &automaton, MultiMatchCallback report)
+        : automaton_(automaton),
+          report_(std::move(report)),
+          state_(0),
+          position_(0) {
+    int total = 0;
+    for (int pattern = 0; pattern < automaton.PatternCount(); ++pattern) {
+        std::size_t ring = 1;
+        while (ring < static_cast<std::size_t>(automaton.PatternLength(pattern)))
+            ring *= 2;
+        ring_begin_.push_back(total);
+        ring_mask_.push_back(ring - 1);
+        chunk_count_.push_back(automaton.ChunkCount(pattern));
+        total += ring;
+        if (automaton.ChunkCount(pattern) == 0)
+            wildcard_only_.push_back(pattern);
+    }
+    counters_.assign(total, Counter{0, 0});
+}
+
+template <class Alphabet>
+void StreamingSearcher<Alphabet>::Feed(const char *data, std::size_t length) {
+    if (!automaton_.valid_)
         return;
+    if (automaton_.mode_ == BuildMode::kEager) {
+        Scan<true>(data, length);
+    } else {
+        Scan<false>(data, length);
+    }
+}
 
-    int i = 0;
-    std::vector<int> solver(text.length());
+template <class Alphabet>
+void AhoCorasick<Alphabet>::ParallelStringSearch(const char *text, std::size_t length, unsigned int threads) {
+    /* Позиции начала шаблона делятся на threads отрезков, каждый поток сканирует свой отрезок
+     * и еще pattern_length_ - 1 символов следующего. Поток начинает из корня, поэтому видит все
+     * подстроки шаблонов, начинающиеся в его отрезке, а сообщает только вхождения, начавшиеся
+     * в его отрезке: на стыках вхождения не теряются и не повторяются. Таблицы автомата
+     * достраиваются заранее, чтобы потоки только читали общие данные.
+     */
+    if (!valid_)
+        return;
+    int shortest = *std::min_element(tables_.pattern_lengths, tables_.pattern_lengths + PatternCount());
+    if (length < static_cast<std::size_t>(shortest))
+        return;
+    if (mode_ == BuildMode::kLazy) {
+        BuildEager();
+        mode_ = BuildMode::kEager;
+    }
+    if (threads == 0)
+        threads = 1;
 
-    for (int character = 0; character < text.length(); ++character) {
-        auto t = static_cast<int> (text[character]- 'a');
-        i = GetDelta(i, t);
+    std::size_t positions = length - shortest + 1;
+    std::size_t step = (positions + threads - 1) / threads;
+    std::vector<std::vector<WildcardMatch> > results(threads);
+    std::vector<std::thread> workers;
+    for (unsigned int w = 0; w < threads; ++w) {
+        std::size_t begin = std::min(positions, w * step);
+        std::size_t end = std::min(positions, begin + step);
+        if (begin == end)
+            break;
+        workers.emplace_back([this, text, length, begin, end, &results, w]() {
+            std::vector<WildcardMatch>& found = results[w];
+            StreamingSearcher<Alphabet> searcher(*this, [&found, begin, end](int pattern, std::size_t position) {
+                if (begin + position < end)
+                    found.push_back({pattern, begin + position});
+            });
+            searcher.Feed(text + begin, std::min(length, end + pattern_length_ - 1) - begin);
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    for (const std::vector<WildcardMatch>& found : results)
+        answer_.insert(answer_.end(), found.begin(), found.end());
+}
+
+template <class Alphabet>
+void AhoCorasick<Alphabet>::PrefilterSearch(const char *text, std::size_t length, bool vectorized) {
+    /* Поиск с фильтром кандидатов для редких вхождений. Берется самая длинная подстрока шаблона
+     * "между вопросиками", и векторными сравнениями (AVX2/SSE2, иначе побайтно) ищутся позиции,
+     * где совпадают ее первый и последний символы. Только эти окна сверяются со всем шаблоном.
+     * При плотных совпадениях проверка стоит O(m) на кандидата, и StringSearch выгоднее.
+     * Символы сравниваются побайтно; у корректного автомата (IsValid) классы алфавита различают
+     * все байты шаблона, поэтому ответ совпадает с поиском автоматом.
+     * Для набора шаблонов делается по одному проходу на шаблон. При vectorized = false кандидаты
+     * ищутся только побайтным циклом - для сравнения с векторным путем.
+     */
+    if (!valid_)
+        return;
+    if (snapshot_) {
+        ParallelStringSearch(text, length, 1);
+        return;
+    }
+    for (int pattern = 0; pattern < PatternCount(); ++pattern)
+        PrefilterPattern(text, length, pattern, vectorized);
+}
+
+template <class Alphabet>
+void AhoCorasick<Alphabet>::PrefilterPattern(const char *text, std::size_t length, int pattern, bool vectorized) {
+    if (length < static_cast<std::size_t>(pattern_lengths_[pattern]))
+        return;
+    std::size_t positions = length - pattern_lengths_[pattern] + 1;
+    if (ChunkCount(pattern) == 0) {
+        for (std::size_t j = 0; j < positions; ++j)
+            answer_.push_back({pattern, j});
+        return;
+    }
+
+    int best = chunk_begin_[pattern];
+    for (int i = best + 1; i < chunk_begin_[pattern + 1]; ++i) {
+        if (string_vector[i].length() > string_vector[best].length())
+            best = i;
+    }
+    const std::string &chunk = string_vector[best];
+    std::size_t chunk_length = chunk.length();
+    std::size_t offset = starts_[best] - chunk_length;
+    // Кандидаты - позиции подстроки в тексте от offset до last включительно.
+    std::size_t p = offset;
+    std::size_t last = offset + positions - 1;
+    auto check = [&](std::size_t candidate) {
+        if (MatchesAt(text, candidate - offset, pattern))
+            answer_.push_back({pattern, candidate - offset});
+    };
+
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(chunk[0]);
+    const __m256i final = _mm256_set1_epi8(chunk[chunk_length - 1]);
+    for (; vectorized && p + 32 <= last + 1; p += 32) {
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + p));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + p + chunk_length - 1));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, final))));
+        while (mask != 0) {
+            check(p + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(chunk[0]);
+    const __m128i final = _mm_set1_epi8(chunk[chunk_length - 1]);
+    for (; vectorized && p + 16 <= last + 1; p += 16) {
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + p));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + p + chunk_length - 1));
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, final))));
+        while (mask != 0) {
+            check(p + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#else
+    static_cast<void>(vectorized);
+#endif
+    for (; p <= last; ++p) {
+        if (text[p] == chunk[0] && text[p + chunk_length - 1] == chunk[chunk_length - 1])
+            check(p);
+    }
+}
+
+template <class Alphabet>
+bool AhoCorasick<Alphabet>::MatchesAt(const char *text, std::size_t position, int pattern) const {
+    for (int i = chunk_begin_[pattern]; i < chunk_begin_[pattern + 1]; ++i) {
+        std::size_t chunk_length = string_vector[i].length();
+        if (std::memcmp(text + position + starts_[i] - chunk_length, string_vector[i].data(), chunk_length) != 0)
+            return false;
+    }
+    return true;
+}
+
+template <int Words>
+ShiftAndSearcher<Words>::ShiftAndSearcher(const std::string &pattern, MatchCallback report)
+        : masks_(256),
+          state_(),
+          last_word_((pattern.length() - 1) / 64),
+          last_bit_(uint64_t(1) << ((pattern.length() - 1) % 64)),
+          pattern_length_(pattern.length()),
+          position_(0),
+          report_(std::move(report)) {
+    for (Bits &mask : masks_)
+        mask.fill(0);
+    last_.fill(0);
+    last_[last_word_] = last_bit_;
+    for (int k = 0; k < pattern_length_; ++k) {
+        uint64_t bit = uint64_t(1) << (k % 64);
+        if (pattern[k] == '?') {
+            for (Bits &mask : masks_)
+                mask[k / 64] |= bit;
+        } else {
+            masks_[static_cast<unsigned char>(pattern[k])][k / 64] |= bit;
+        }
+    }
+}
+
+template <int Words>
+void ShiftAndSearcher<Words>::Feed(const char *data, std::size_t length) {
+    Bits state = state_;
+    for (std::size_t character = 0; character < length; ++character, ++position_) {
+        const Bits &mask = masks_[static_cast<unsigned char>(data[character])];
+        uint64_t carry = 1;
+        for (int w = 0; w < Words; ++w) {
+            uint64_t next_carry = state[w] >> 63;
+            state[w] = ((state[w] << 1) | carry) & mask[w];
+            carry = next_carry;
+        }
+        if (state[last_word_] & last_bit_)
+            report_(position_ + 1 - pattern_length_);
+    }
+    state_ = state;
+}
+
+#if defined(__AVX2__)
+template <>
+void ShiftAndSearcher<4>::Feed(const char *data, std::size_t length) {
+    /* Старшие биты полос переставляются на полосу выше (permute4x64), младшая полоса
+     * получает входную единицу.
+     */
+    const __m256i one = _mm256_set_epi64x(0, 0, 0, 1);
+    const __m256i last = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(last_.data()));
+    __m256i state = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state_.data()));
+    for (std::size_t character = 0; character < length; ++character, ++position_) {
+        __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks_[static_cast<unsigned char>(data[character])].data()));
+        __m256i top = _mm256_permute4x64_epi64(_mm256_srli_epi64(state, 63), 0x93);
+        __m256i carry = _mm256_blend_epi32(top, one, 0x03);
+        state = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi64(state, 1), carry), mask);
+        if (!_mm256_testz_si256(state, last))
+            report_(position_ + 1 - pattern_length_);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(state_.data()), state);
+}
+#elif defined(__SSE2__)
+template <>
+void ShiftAndSearcher<4>::Feed(const char *data, std::size_t length) {
+    /* Пара регистров SSE2: старший бит верхней полосы low переносится в младшую полосу high.
+     */
+    const __m128i one = _mm_set_epi64x(0, 1);
+    const __m128i last_low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(last_.data()));
+    const __m128i last_high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(last_.data() + 2));
+    __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state_.data()));
+    __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state_.data() + 2));
+    for (std::size_t character = 0; character < length; ++character, ++position_) {
+        const uint64_t *mask = masks_[static_cast<unsigned char>(data[character])].data();
+        __m128i low_top = _mm_srli_epi64(low, 63);
+        __m128i high_carry = _mm_or_si128(_mm_slli_si128(_mm_srli_epi64(high, 63), 8), _mm_srli_si128(low_top, 8));
+        __m128i low_carry = _mm_or_si128(_mm_slli_si128(low_top, 8), one);
+        low = _mm_and_si128(_mm_or_si128(_mm_slli_epi64(low, 1), low_carry),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask)));
+        high = _mm_and_si128(_mm_or_si128(_mm_slli_epi64(high, 1), high_carry),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask + 2)));
+        __m128i hit = _mm_or_si128(_mm_and_si128(low, last_low), _mm_and_si128(high, last_high));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128())) != 0xFFFF)
+            report_(position_ + 1 - pattern_length_);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state_.data()), low);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state_.data() + 2), high);
+}
+#endif
+
+WildcardSearcher::WildcardSearcher(const std::string &pattern, MatchCallback report) {
+    if (pattern.length() <= 64) {
+        engine_.reset(new ShiftAndEngine<1>(pattern, std::move(report)));
+    } else if (pattern.length() <= 128) {
+        engine_.reset(new ShiftAndEngine<2>(pattern, std::move(report)));
+    } else if (pattern.length() <= 256) {
+        engine_.reset(new ShiftAndEngine<4>(pattern, std::move(report)));
+    } else if (pattern.length() <= 320) {
+        engine_.reset(new ShiftAndEngine<5>(pattern, std::move(report)));
+    } else {
+        engine_.reset(new AutomatonEngine(pattern, std::move(report)));
+    }
+}
+
+bool ParseThreads(const char *text, unsigned int &threads) {
+    /* Число потоков - целое не меньше 1 без лишних символов; больше
+     * kMaxThreadsPerCore * hardware_concurrency() урезается до этой границы.
+     */
+    char *end;
+    long value = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < 1)
+        return false;
+    unsigned long limit = kMaxThreadsPerCore * std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned int>(std::min<unsigned long>(value, limit));
+    return true;
+}
+
+MappedFile::MappedFile(const char *path, bool trim_whitespace) : data_(nullptr), length_(0), mapped_length_(0), is_open_(false) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        close(fd);
+        return;
+    }
+    mapped_length_ = info.st_size;
+    if (mapped_length_ == 0) {
+        close(fd);
+        is_open_ = true;
+        return;
+    }
+    void *mapped = mmap(nullptr, mapped_length_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        mapped_length_ = 0;
+        return;
+    }
+    madvise(mapped, mapped_length_, MADV_SEQUENTIAL);
+
+    data_ = static_cast<const char *>(mapped);
+    length_ = mapped_length_;
+    while (trim_whitespace && length_ > 0 && std::isspace(static_cast<unsigned char>(data_[length_ - 1])))
+        --length_;
+    is_open_ = true;
+}
+
+MappedFile::~MappedFile() {
+    if (mapped_length_ != 0)
+        munmap(const_cast<char *>(data_), mapped_length_);
+}
+
+template <class Searcher>
+bool SearchMappedFile(const char *path, Searcher &searcher) {
+    /* Байты файла подаются автомату прямо из отображения, без копирования.
+     */
+    MappedFile file(path);
+    if (!file.IsOpen())
+        return false;
+    searcher.Feed(file.Data(), file.Size());
+    return true;
+}
+
+template <class Alphabet>
+template <bool kEager>
+void StreamingSearcher<Alphabet>::Scan(const char *data, std::size_t length) {
+    /* Вхождение подстроки шаблона со смещением line, закончившееся на текущем символе, увеличивает
+     * счетчик начала шаблона, лежащего на line - 1 символов раньше. Когда счетчик набирает число
+     * подстрок шаблона, вхождение откладывается до конца окна (за последней подстрокой могут идти
+     * вопросики). В режиме kEager переход и ссылка на выход - одно чтение из готовой таблицы.
+     */
+    AhoCorasick<Alphabet> &ac = automaton_;
+    const typename AhoCorasick<Alphabet>::Tables &tables = ac.tables_;
+    // Указатели таблиц читаются в локальные переменные: иначе вызовы report_ и push
+    // заставляют компилятор перечитывать их из памяти на каждом смещении.
+    const int32_t *line_begin = tables.line_begin;
+    const int32_t *lines = tables.lines;
+    const int32_t *line_pattern = tables.line_pattern;
+    Counter *counters = counters_.data();
+    int i = state_;
+    std::size_t position = position_;
+    for (std::size_t character = 0; character < length; ++character, ++position) {
+        int t = tables.classes[static_cast<unsigned char>(data[character])];
+        i = kEager ? tables.delta[i * ac.power_ + t] : ac.GetDelta(i, t);
 
         int temporary_ind = i;
         while (temporary_ind != 0) {
-            if (nodes_[temporary_ind].is_leaf_) {
-                for (int line : nodes_[temporary_ind].lines_) {
-                    if (character - line + 1 >= 0) {
-                        ++solver[character - line + 1];
+            for (int k = line_begin[temporary_ind], end = line_begin[temporary_ind + 1]; k < end; ++k) {
+                if (position + 1 >= static_cast<std::size_t>(lines[k])) {
+                    std::size_t start = position + 1 - lines[k];
+                    int pattern = line_pattern[k];
+                    Counter &counter = counters[ring_begin_[pattern] + (start & ring_mask_[pattern])];
+                    if (counter.position != start + 1) {
+                        counter.position = start + 1;
+                        counter.count = 0;
                     }
+                    if (++counter.count == chunk_count_[pattern])
+                        pending_.push({start + tables.pattern_lengths[pattern] - 1, pattern, start});
                 }
             }
-            temporary_ind = GetUpLink(temporary_ind);
+            temporary_ind = kEager ? tables.up_link[temporary_ind] : ac.GetUpLink(temporary_ind);
         }
-    }
 
-    for (int j = 0; j < solver.size() - pattern_length_ + 1; ++j) {
-        if (solver[j] == string_vector.size())
-            answer_.push_back(j);
+        // Шаблоны из одних вопросиков входят с каждой позиции.
+        for (int pattern : wildcard_only_) {
+            if (position + 1 >= static_cast<std::size_t>(tables.pattern_lengths[pattern]))
+                report_(pattern, position + 1 - tables.pattern_lengths[pattern]);
+        }
+        while (!pending_.empty() && pending_.top().due <= position) {
+            report_(pending_.top().pattern, pending_.top().position);
+            pending_.pop();
+        }
     }
+    position_ = position;
+    state_ = i;
 }
 
-void AhoCorasick::Prepare(const std::string &text) {
-    int i = 0;
+template <class Alphabet>
+void AhoCorasick<Alphabet>::Prepare(const std::string &text, int pattern) {
+    std::size_t i = 0;
     while (i < text.length()) {
         std::string current;
-        while (text[i] == '?'&& i < text.length())
+        while (i < text.length() && text[i] == '?')
             ++i;
         if (i < text.length()) {
-            while (text[i] != '?' && i < text.length()) {
+            while (i < text.length() && text[i] != '?') {
                 current += text[i];
                 ++i;
             }
             string_vector.push_back(current);
             starts_.push_back(i);
+            chunk_pattern_.push_back(pattern);
         }
     }
 }
 
-void AhoCorasick::AddString(const std::string &text, int ind) {
+template <class Alphabet>
+int AhoCorasick<Alphabet>::AddState(int parent, int state_by_char) {
+    int state = parent_.size();
+    next_states_.resize(next_states_.size() + power_, -1);
+    delta_.resize(delta_.size() + power_, -1);
+    parent_.push_back(parent);
+    state_by_char_.push_back(state_by_char);
+    suf_link_.push_back(-1);
+    up_link_.push_back(-1);
+    return state;
+}
+
+template <class Alphabet>
+void AhoCorasick<Alphabet>::AddString(const std::string &text) {
     int state = 0;
     for (char character : text) {
         int temporary_state;
-        temporary_state = static_cast<int>(character - 'a');
-        if (nodes_[state].next_states_[temporary_state] == -1) {
-            Node node(power_);
-            node.suf_link_ = -1;
-            node.parent_ = state;
-            node.state_by_char_ = temporary_state;
-            nodes_[state].next_states_[temporary_state] = last_;
-            nodes_.push_back(node);
-            ++last_;
+        temporary_state = alphabet_.Index(static_cast<unsigned char>(character));
+        if (next_states_[state * power_ + temporary_state] == -1) {
+            int new_state = AddState(state, temporary_state);
+            next_states_[state * power_ + temporary_state] = new_state;
         }
 
-        state = nodes_[state].next_states_[temporary_state];
+        state = next_states_[state * power_ + temporary_state];
     }
 
+    line_state_.push_back(state);
+}
+
+template <class Alphabet>
+void AhoCorasick<Alphabet>::BuildLineIndex() {
+    // Сортировка подсчетом по конечному состоянию; внутри состояния подстроки идут в порядке добавления.
+    line_begin_.assign(parent_.size() + 1, 0);
+    for (int32_t state : line_state_)
+        ++line_begin_[state + 1];
+    for (std::size_t state = 0; state + 1 < line_begin_.size(); ++state)
+        line_begin_[state + 1] += line_begin_[state];
+    std::vector<int32_t> position(line_begin_.begin(), line_begin_.end() - 1);
+    lines_.resize(line_state_.size());
+    line_pattern_.resize(line_state_.size());
+    for (std::size_t ind = 0; ind < line_state_.size(); ++ind) {
+        int32_t line = position[line_state_[ind]]++;
+        lines_[line] = starts_[ind];
+        line_pattern_[line] = chunk_pattern_[ind];
+    }
+    line_state_.clear();
+    line_state_.shrink_to_fit();
+}
 
-    nodes_[state].is_leaf_ = true;
-    nodes_[state].lines_.push_back(starts_[ind]);
+template <class Alphabet>
+void AhoCorasick<Alphabet>::BuildEager() {
+    /* Обход в ширину: к моменту обработки состояния все состояния меньшей глубины,
+     * в том числе его суффиксная ссылка, уже полностью посчитаны.
+     */
+    std::queue<int> order;
+    suf_link_[0] = 0;
+    up_link_[0] = 0;
+    order.push(0);
+    while (!order.empty()) {
+        int state = order.front();
+        order.pop();
+        int suf = suf_link_[state];
+        for (int a = 0; a < power_; ++a) {
+            int cell = state * power_ + a;
+            int next = next_states_[cell];
+            if (next == -1) {
+                delta_[cell] = (state == 0) ? 0 : delta_[suf * power_ + a];
+                continue;
+            }
+            delta_[cell] = next;
+            int next_suf = (state == 0) ? 0 : delta_[suf * power_ + a];
+            suf_link_[next] = next_suf;
+            up_link_[next] = IsLeaf(next_suf) ? next_suf : up_link_[next_suf];
+            order.push(next);
+        }
+    }
 }
 
-int AhoCorasick::GetSuffLink(int state) {
-    if (nodes_[state].suf_link_ == -1) {
-        int par = nodes_[state].parent_, sbc = nodes_[state].state_by_char_;
+template <class Alphabet>
+int AhoCorasick<Alphabet>::GetSuffLink(int state) {
+    if (suf_link_[state] == -1) {
+        int par = parent_[state], sbc = state_by_char_[state];
         if (state == 0 || par == 0) {
-            nodes_[state].suf_link_ = 0;
+            suf_link_[state] = 0;
         } else {
-            nodes_[state].suf_link_ = GetDelta(GetSuffLink(par), sbc);
+            suf_link_[state] = GetDelta(GetSuffLink(par), sbc);
         }
     }
-    return nodes_[state].suf_link_;
+    return suf_link_[state];
 }
 
-int AhoCorasick::GetDelta(int state, int a) {
-    if (nodes_[state].delta_[a] == -1)
-        if (nodes_[state].next_states_[a] != -1) {
-            nodes_[state].delta_[a] = nodes_[state].next_states_[a];
+template <class Alphabet>
+int AhoCorasick<Alphabet>::GetDelta(int state, int a) {
+    int cell = state * power_ + a;
+    if (delta_[cell] == -1) {
+        if (next_states_[cell] != -1) {
+            delta_[cell] = next_states_[cell];
         } else {
-            nodes_[state].delta_[a] = (state == 0) ? 0 : GetDelta(GetSuffLink(state), a);
+            delta_[cell] = (state == 0) ? 0 : GetDelta(GetSuffLink(state), a);
         }
+    }
 
-    return nodes_[state].delta_[a];
+    return delta_[cell];
 }
 
-int AhoCorasick::GetUpLink(int state) {
-    if (nodes_[state].up_link_ == -1) {
+template <class Alphabet>
+int AhoCorasick<Alphabet>::GetUpLink(int state) {
+    if (up_link_[state] == -1) {
         int temporary_state = GetSuffLink(state);
-        if (nodes_[temporary_state].is_leaf_) {
-            nodes_[state].up_link_ = temporary_state;
+        if (IsLeaf(temporary_state)) {
+            up_link_[state] = temporary_state;
         } else {
-            nodes_[state].up_link_ = temporary_state == 0 ? 0 : GetUpLink(temporary_state);
+            up_link_[state] = temporary_state == 0 ? 0 : GetUpLink(temporary_state);
         }
     }
-    return  nodes_[state].up_link_;
+    return  up_link_[state];
+}
+
+/* Замеры для --bench. Текст - псевдослучайные байты "abcd" с фиксированным зерном, шаблоны -
+ * его подстроки, в которых каждый wildcard_every-й символ заменен вопросиком, поэтому у каждого
+ * шаблона есть вхождения и прогоны повторяемы. Время - по steady_clock, одно измерение на ячейку.
+ */
+template <class Function>
+double Seconds(Function function) {
+    auto begin = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Символы текста равновероятно выбираются из letters; повторяя букву в letters, можно сделать текст неравномерным.
+std::string BenchText(std::size_t length, uint64_t seed, const std::string &letters = "abcd") {
+    std::string text(length, 'a');
+    for (char &character : text) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        character = letters[((seed >> 40) * letters.length()) >> 24];
+    }
+    return text;
+}
+
+std::string BenchPattern(const std::string &text, std::size_t position, std::size_t length, std::size_t wildcard_every) {
+    std::string pattern = text.substr(position, length);
+    for (std::size_t i = wildcard_every / 2; wildcard_every != 0 && i < pattern.length(); i += wildcard_every)
+        pattern[i] = '?';
+    return pattern;
+}
+
+template <class Alphabet>
+std::size_t CountMatches(AhoCorasick<Alphabet> &automaton, const std::string &text) {
+    std::size_t count = 0;
+    StreamingSearcher<Alphabet> searcher(automaton, typename StreamingSearcher<Alphabet>::MultiMatchCallback(
+            [&count](int, std::size_t) {
+                ++count;
+            }));
+    searcher.Feed(text.data(), text.length());
+    return count;
+}
+
+// Строка секции alphabet: объем таблиц и скорость поиска автомата kEager с политикой Alphabet.
+template <class Alphabet>
+void BenchAlphabet(const char *name, const std::string &pattern, const std::string &text) {
+    AhoCorasick<Alphabet> automaton(pattern);
+    std::size_t matches = 0;
+    double scan = Seconds([&]() {
+        matches = CountMatches(automaton, text);
+    });
+    std::cout << "    " << std::left << std::setw(12) << name << std::right << std::setprecision(1)
+              << std::setw(10) << automaton.TableBytes() / 1024.0 << " KB " << std::setw(8)
+              << text.length() / 1048576.0 / scan << " MB/s" << std::setprecision(4)
+              << " (" << matches << " matches)\n";
+}
+
+template <int Words>
+std::size_t CountShiftAnd(const std::string &pattern, const std::string &text) {
+    std::size_t count = 0;
+    ShiftAndSearcher<Words> searcher(pattern, [&count](std::size_t) {
+        ++count;
+    });
+    searcher.Feed(text.data(), text.length());
+    return count;
+}
+
+// Shift-And с наименьшим числом слов, в которое помещается шаблон (до 1024 символов).
+std::size_t CountShiftAndAnyLength(const std::string &pattern, const std::string &text) {
+    std::size_t length = pattern.length();
+    if (length <= 64)
+        return CountShiftAnd<1>(pattern, text);
+    if (length <= 128)
+        return CountShiftAnd<2>(pattern, text);
+    if (length <= 256)
+        return CountShiftAnd<4>(pattern, text);
+    if (length <= 320)
+        return CountShiftAnd<5>(pattern, text);
+    if (length <= 384)
+        return CountShiftAnd<6>(pattern, text);
+    if (length <= 512)
+        return CountShiftAnd<8>(pattern, text);
+    return CountShiftAnd<16>(pattern, text);
+}
+
+/* Прежняя раскладка автомата для сравнения в --bench: каждая вершина - объект со своими векторами
+ * переходов и смещений, таблицы достраиваются лениво, а поиск, как и раньше, ведет счетчик на каждую
+ * позицию текста. Алфавит - строчные латинские буквы, как в исходной версии.
+ */
+struct BenchNode {
+    std::vector<int> next_states_;
+    std::vector<int> delta_;
+    std::vector<int> lines_;
+    bool is_leaf_;
+    int parent_;
+    int state_by_char_;
+    int suf_link_;
+    int up_link_;
+    explicit BenchNode(int n) : is_leaf_(false), parent_(0), state_by_char_(0), suf_link_(-1), up_link_(-1) {
+        next_states_.assign(n, -1);
+        delta_.assign(n, -1);
+    }
+};
+
+class NodeLayoutAutomaton {
+public:
+    explicit NodeLayoutAutomaton(const std::string & pattern) : power_(26), pattern_length_(pattern.length()) {
+        std::size_t i = 0;
+        while (i < pattern.length()) {
+            std::string current;
+            while (i < pattern.length() && pattern[i] == '?')
+                ++i;
+            while (i < pattern.length() && pattern[i] != '?')
+                current += pattern[i++];
+            if (!current.empty()) {
+                string_vector.push_back(current);
+                starts_.push_back(i);
+            }
+        }
+        nodes_.push_back(BenchNode(power_));
+        for (std::size_t k = 0; k < string_vector.size(); ++k)
+            AddString(string_vector[k], starts_[k]);
+    }
+
+    std::size_t CountMatches(const std::string& text) {
+        if (text.length() < pattern_length_)
+            return 0;
+        int i = 0;
+        std::vector<int> solver(text.length());
+        for (std::size_t character = 0; character < text.length(); ++character) {
+            i = GetDelta(i, text[character] - 'a');
+            for (int temporary_ind = i; temporary_ind != 0; temporary_ind = GetUpLink(temporary_ind)) {
+                for (int line : nodes_[temporary_ind].lines_) {
+                    if (character + 1 >= static_cast<std::size_t>(line))
+                        ++solver[character + 1 - line];
+                }
+            }
+        }
+        std::size_t count = 0;
+        for (std::size_t j = 0; j + pattern_length_ <= text.length(); ++j)
+            count += static_cast<std::size_t>(solver[j]) == string_vector.size();
+        return count;
+    }
+
+private:
+    std::vector<std::string> string_vector;
+    std::vector<int> starts_;
+    std::vector<BenchNode> nodes_;
+    int power_;
+    std::size_t pattern_length_;
+
+    void AddString(const std::string & text, int line) {
+        int state = 0;
+        for (char character : text) {
+            int a = character - 'a';
+            if (nodes_[state].next_states_[a] == -1) {
+                BenchNode node(power_);
+                node.parent_ = state;
+                node.state_by_char_ = a;
+                nodes_[state].next_states_[a] = nodes_.size();
+                nodes_.push_back(node);
+            }
+            state = nodes_[state].next_states_[a];
+        }
+        nodes_[state].is_leaf_ = true;
+        nodes_[state].lines_.push_back(line);
+    }
+
+    int GetSuffLink(int state) {
+        if (nodes_[state].suf_link_ == -1) {
+            int par = nodes_[state].parent_;
+            nodes_[state].suf_link_ = (state == 0 || par == 0) ? 0 : GetDelta(GetSuffLink(par), nodes_[state].state_by_char_);
+        }
+        return nodes_[state].suf_link_;
+    }
+
+    int GetDelta(int state, int a) {
+        if (nodes_[state].delta_[a] == -1) {
+            if (nodes_[state].next_states_[a] != -1)
+                nodes_[state].delta_[a] = nodes_[state].next_states_[a];
+            else
+                nodes_[state].delta_[a] = (state == 0) ? 0 : GetDelta(GetSuffLink(state), a);
+        }
+        return nodes_[state].delta_[a];
+    }
+
+    int GetUpLink(int state) {
+        if (nodes_[state].up_link_ == -1) {
+            int temporary_state = GetSuffLink(state);
+            if (nodes_[temporary_state].is_leaf_)
+                nodes_[state].up_link_ = temporary_state;
+            else
+                nodes_[state].up_link_ = temporary_state == 0 ? 0 : GetUpLink(temporary_state);
+        }
+        return nodes_[state].up_link_;
+    }
+};
+
+/* Замер в дочернем процессе: build и scan (возвращает число вхождений) выполняются в копии
+ * процесса после fork, а пик памяти - прирост VmHWM над VmRSS на момент fork. Поэтому память, занятая и освобожденная
+ * прежними замерами, в результат не попадает.
+ */
+struct Footprint {
+    double build;
+    double scan;
+    std::size_t matches;
+    long build_peak_kb;
+    long peak_kb;
+};
+
+long StatusKilobytes(const char *key) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, std::strlen(key), key) == 0)
+            return std::strtol(line.c_str() + std::strlen(key), nullptr, 10);
+    }
+    return 0;
+}
+
+template <class Build, class Scan>
+bool MeasureInChild(Build build, Scan scan, Footprint &footprint) {
+    int channel[2];
+    if (pipe(channel) != 0)
+        return false;
+    pid_t child = fork();
+    if (child == -1) {
+        close(channel[0]);
+        close(channel[1]);
+        return false;
+    }
+    if (child == 0) {
+        close(channel[0]);
+        Footprint result;
+        long resident = StatusKilobytes("VmRSS:");
+        result.build = Seconds(build);
+        result.build_peak_kb = StatusKilobytes("VmHWM:") - resident;
+        result.scan = Seconds([&]() {
+            result.matches = scan();
+        });
+        result.peak_kb = StatusKilobytes("VmHWM:") - resident;
+        bool written = write(channel[1], &result, sizeof(result)) == static_cast<ssize_t>(sizeof(result));
+        _exit(written ? 0 : 1);
+    }
+    close(channel[1]);
+    bool received = read(channel[0], &footprint, sizeof(footprint)) == static_cast<ssize_t>(sizeof(footprint));
+    close(channel[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int RunBenchmarks(std::size_t text_size, unsigned int threads) {
+    /* Каждая секция отвечает на вопрос одного из режимов:
+     * mode - kLazy или kEager для данной пары (шаблон, текст): построение и поиск отдельно;
+     * layout - плоские массивы против прежних вершин со своими векторами (NodeLayoutAutomaton)
+     * при том же алфавите из 26 букв: время, скорость поиска и пик памяти в дочернем процессе;
+     * alphabet - ширина строки таблицы переходов (Lowercase 27, Ascii 129, Byte 256, Compressed -
+     * по числу символов шаблона) против объема таблиц и скорости поиска;
+     * input - поиск по временному файлу через MappedFile против чтения потоком (целиком в строку,
+     * как прежний путь стандартного ввода, и блоками, как нынешний): время и пик памяти;
+     * threads - ускорение ParallelStringSearch от числа потоков;
+     * shift-and - с какой длины шаблона автомат выгоднее Shift-And (по ней WildcardSearcher
+     * берет Shift-And до 320 символов);
+     * prefilter - PrefilterSearch с побайтным и векторным поиском кандидатов против автомата
+     * на редком и частом шаблоне;
+     * batch - как скорость общего прохода падает с числом шаблонов (16, 256, 4096);
+     * snapshot - загрузка снимка против построения.
+     */
+    typedef AhoCorasick<CompressedAlphabet> Automaton;
+    std::cout << std::fixed << std::setprecision(4);
+    const std::string text = BenchText(text_size, 0x9E3779B97F4A7C15ULL);
+    // Текст для огромного шаблона вдвое длиннее шаблона и содержит его вхождение.
+    const std::string huge_text = text.substr(0, text_size / 4);
+    std::cout << "text " << (text_size >> 20) << " MB, threads up to " << threads << "\n";
+
+    struct Workload {
+        const char *name;
+        std::string pattern;
+        const std::string *text;
+    };
+    std::vector<Workload> workloads;
+    workloads.push_back({"12 chars, long text", BenchPattern(text, 1000, 12, 5), &text});
+    workloads.push_back({"3000 chunks, long text", BenchPattern(text, 5000, 15000, 5), &text});
+    workloads.push_back({"huge pattern, 2x text", BenchPattern(text, text_size / 16, text_size / 8, 8), &huge_text});
+    std::cout << "\nmode: build s / scan s per BuildMode\n";
+    for (const Workload &workload : workloads) {
+        std::cout << "  " << std::left << std::setw(26) << workload.name << std::right;
+        const BuildMode modes[] = {BuildMode::kLazy, BuildMode::kEager};
+        for (BuildMode mode : modes) {
+            std::unique_ptr<Automaton> automaton;
+            std::size_t matches = 0;
+            double build = Seconds([&]() {
+                automaton.reset(new Automaton(workload.pattern, mode));
+            });
+            double scan = Seconds([&]() {
+                matches = CountMatches(*automaton, *workload.text);
+            });
+            std::cout << (mode == BuildMode::kLazy ? "  lazy " : "  eager ") << build << " / " << scan
+                      << " (" << matches << " matches)";
+        }
+        std::cout << "\n";
+    }
+
+    std::cout << "\nlayout: build s / scan MB/s / peak RSS MB after build, after scan\n";
+    for (const Workload &workload : workloads) {
+        std::cout << "  " << workload.name << "\n";
+        auto report = [&workload](const char *layout, bool measured, const Footprint &footprint) {
+            std::cout << "    " << std::left << std::setw(18) << layout << std::right;
+            if (!measured) {
+                std::cout << "measurement failed\n";
+                return;
+            }
+            std::cout << footprint.build << " / " << std::setprecision(1)
+                      << workload.text->length() / 1048576.0 / footprint.scan << " / "
+                      << footprint.build_peak_kb / 1024.0 << ", " << footprint.peak_kb / 1024.0
+                      << std::setprecision(4) << " (" << footprint.matches << " matches)\n";
+        };
+        Footprint footprint;
+        std::unique_ptr<NodeLayoutAutomaton> node_layout;
+        bool measured = MeasureInChild([&]() {
+            node_layout.reset(new NodeLayoutAutomaton(workload.pattern));
+        }, [&]() {
+            return node_layout->CountMatches(*workload.text);
+        }, footprint);
+        report("per-Node, lazy", measured, footprint);
+        const BuildMode modes[] = {BuildMode::kLazy, BuildMode::kEager};
+        for (BuildMode mode : modes) {
+            std::unique_ptr<AhoCorasick<LowercaseAlphabet> > automaton;
+            measured = MeasureInChild([&]() {
+                automaton.reset(new AhoCorasick<LowercaseAlphabet>(workload.pattern, mode));
+            }, [&]() {
+                return CountMatches(*automaton, *workload.text);
+            }, footprint);
+            report(mode == BuildMode::kLazy ? "arrays, lazy" : "arrays, eager", measured, footprint);
+        }
+    }
+
+    std::cout << "\nalphabet: table KB / scan MB/s per alphabet policy, eager\n";
+    for (const Workload &workload : workloads) {
+        std::cout << "  " << workload.name << "\n";
+        BenchAlphabet<LowercaseAlphabet>("lowercase", workload.pattern, *workload.text);
+        BenchAlphabet<AsciiAlphabet>("ascii", workload.pattern, *workload.text);
+        BenchAlphabet<ByteAlphabet>("byte", workload.pattern, *workload.text);
+        BenchAlphabet<CompressedAlphabet>("compressed", workload.pattern, *workload.text);
+    }
+
+    std::cout << "\ninput: read s / scan s / peak RSS MB reading a " << (text_size >> 20)
+              << " MB temporary file, 12-char pattern\n";
+    {
+        char path[] = "/tmp/aho-corasick-bench-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd == -1) {
+            std::cerr << "Cannot create a temporary file" << std::endl;
+            return 1;
+        }
+        close(fd);
+        std::ofstream(path, std::ios::binary) << text << '\n';
+        Automaton automaton(workloads[0].pattern);
+        auto report = [](const char *input, bool measured, const Footprint &footprint) {
+            std::cout << "  " << std::left << std::setw(22) << input << std::right;
+            if (!measured) {
+                std::cout << "measurement failed\n";
+                return;
+            }
+            std::cout << footprint.build << " / " << footprint.scan << " / " << std::setprecision(1)
+                      << footprint.peak_kb / 1024.0 << std::setprecision(4) << " (" << footprint.matches << " matches)\n";
+        };
+        // Отображение: чтения нет, страницы подгружаются при поиске и учитываются в RSS как страницы файла.
+        Footprint footprint;
+        std::unique_ptr<MappedFile> file;
+        bool measured = MeasureInChild([&]() {
+            file.reset(new MappedFile(path));
+        }, [&]() {
+            std::size_t matches = 0;
+            StreamingSearcher<CompressedAlphabet> searcher(automaton, [&matches](std::size_t) {
+                ++matches;
+            });
+            searcher.Feed(file->Data(), file->Size());
+            return matches;
+        }, footprint);
+        report("mmap", measured, footprint);
+        // Прежний путь стандартного ввода: весь текст копируется в строку через поток.
+        std::string copy;
+        measured = MeasureInChild([&]() {
+            std::ifstream input(path, std::ios::binary);
+            input >> copy;
+        }, [&]() {
+            return CountMatches(automaton, copy);
+        }, footprint);
+        report("stream, whole text", measured, footprint);
+        // Нынешний путь стандартного ввода: блоки по 64 КБ подаются в StreamingSearcher по мере чтения.
+        measured = MeasureInChild([]() {}, [&]() {
+            std::size_t matches = 0;
+            StreamingSearcher<CompressedAlphabet> searcher(automaton, [&matches](std::size_t) {
+                ++matches;
+            });
+            std::ifstream input(path, std::ios::binary);
+            std::vector<char> buffer(1 << 16);
+            while (input) {
+                input.read(buffer.data(), buffer.size());
+                std::size_t length = input.gcount();
+                while (length > 0 && std::isspace(static_cast<unsigned char>(buffer[length - 1])))
+                    --length;
+                searcher.Feed(buffer.data(), length);
+            }
+            return matches;
+        }, footprint);
+        report("stream, 64 KB blocks", measured, footprint);
+        unlink(path);
+    }
+
+    std::cout << "\nthreads: ParallelStringSearch, 12-char pattern\n";
+    double single = 0;
+    for (unsigned int count = 1; count <= threads; count = count * 2 > threads && count < threads ? threads : count * 2) {
+        Automaton automaton(workloads[0].pattern);
+        double elapsed = Seconds([&]() {
+            automaton.ParallelStringSearch(text.data(), text.length(), count);
+        });
+        if (count == 1)
+            single = elapsed;
+        std::cout << "  " << std::setw(3) << count << " threads " << elapsed << " s, speedup " << single / elapsed << "\n";
+    }
+
+    std::cout << "\nshift-and: Shift-And s / automaton s by pattern length\n";
+    const std::size_t lengths[] = {8, 16, 32, 64, 128, 256, 320, 384, 448, 512, 768, 1024};
+    for (std::size_t length : lengths) {
+        std::string pattern = BenchPattern(text, 777, length, 7);
+        std::size_t shift_and_matches = 0;
+        double shift_and = Seconds([&]() {
+            shift_and_matches = CountShiftAndAnyLength(pattern, text);
+        });
+        std::size_t automaton_matches = 0;
+        double automaton = Seconds([&]() {
+            Automaton built(pattern);
+            automaton_matches = CountMatches(built, text);
+        });
+        std::cout << "  " << std::setw(4) << length << " chars  " << shift_and << " / " << automaton
+                  << (shift_and_matches == automaton_matches ? "" : "  MISMATCH")
+                  << (shift_and <= automaton ? "  shift-and" : "  automaton") << "\n";
+    }
+
+#if defined(__AVX2__)
+    const char *simd = "avx2";
+#elif defined(__SSE2__)
+    const char *simd = "sse2";
+#else
+    const char *simd = "none compiled, same as scalar";
+#endif
+    std::cout << "\nprefilter: automaton / scalar prefilter / SIMD (" << simd << ") prefilter, s\n";
+    /* Редкий шаблон: самая длинная подстрока - 11 символов, кандидатов почти нет. Частый: текст
+     * из 'a' с 'b' примерно на каждой 64-й позиции, первый и последний символ подстроки совпадают
+     * почти везде, и вхождение начинается в большинстве позиций.
+     */
+    const std::string dense_text = BenchText(text_size, 0x2545F4914F6CDD1DULL, std::string(63, 'a') + "b");
+    const Workload prefilter_workloads[] = {
+            {"sparse, 24 chars, '?' every 12", BenchPattern(text, 3333, 24, 12), &text},
+            {"dense, 12 chars over a*b text", "aaaaa?aaaaaa", &dense_text},
+    };
+    for (const Workload &workload : prefilter_workloads) {
+        const std::string &haystack = *workload.text;
+        Automaton automaton(workload.pattern);
+        double streaming = Seconds([&]() {
+            CountMatches(automaton, haystack);
+        });
+        Automaton scalar_automaton(workload.pattern);
+        double scalar = Seconds([&]() {
+            scalar_automaton.PrefilterSearch(haystack.data(), haystack.length(), false);
+        });
+        Automaton vector_automaton(workload.pattern);
+        double vectorized = Seconds([&]() {
+            vector_automaton.PrefilterSearch(haystack.data(), haystack.length());
+        });
+        std::cout << "  " << std::left << std::setw(32) << workload.name << std::right << streaming << " / "
+                  << scalar << " / " << vectorized << "\n";
+    }
+
+    /* Работа на символ - проход по автомату плюс срабатывания подстрок всех шаблонов, и вторая часть
+     * растет с числом шаблонов тем быстрее, чем короче подстроки. На тексте из четырех букв подстрока
+     * из 2 символов (шаблон из 12 с вопросиком через 5) срабатывает в каждой 16-й позиции,
+     * самая короткая подстрока шаблона из 24 с вопросиком через 12 (5 символов) - в каждой 1024-й.
+     */
+    std::cout << "\nbatch: build s / one-pass scan MB/s by number of patterns\n";
+    struct BatchShape {
+        const char *name;
+        std::size_t length;
+        std::size_t wildcard_every;
+    };
+    const BatchShape batch_shapes[] = {
+            {"12 chars, '?' every 5", 12, 5},
+            {"24 chars, '?' every 12", 24, 12},
+    };
+    const std::size_t pattern_counts[] = {16, 256, 4096};
+    for (const BatchShape &shape : batch_shapes) {
+        std::cout << "  " << shape.name << "\n";
+        for (std::size_t count : pattern_counts) {
+            // Шаблоны берутся из равномерно разнесенных позиций текста, так что у каждого есть вхождение.
+            std::vector<std::string> patterns;
+            for (std::size_t i = 0; i < count; ++i)
+                patterns.push_back(BenchPattern(text, (text_size - shape.length) / count * i, shape.length, shape.wildcard_every));
+            std::unique_ptr<Automaton> automaton;
+            double build = Seconds([&]() {
+                automaton.reset(new Automaton(patterns));
+            });
+            std::size_t matches = 0;
+            double one_pass = Seconds([&]() {
+                matches = CountMatches(*automaton, text);
+            });
+            std::cout << "    " << std::setw(5) << count << " patterns  " << build << " / " << std::setprecision(1)
+                      << text_size / 1048576.0 / one_pass << std::setprecision(4) << " (" << matches << " matches)";
+            // Отдельный проход на каждый шаблон замеряется только для небольшого набора.
+            if (count <= 16) {
+                double separate = Seconds([&]() {
+                    for (const std::string &pattern : patterns) {
+                        Automaton single(pattern);
+                        CountMatches(single, text);
+                    }
+                });
+                std::cout << ", one pass per pattern " << std::setprecision(1) << text_size / 1048576.0 / separate
+                          << std::setprecision(4) << " MB/s";
+            }
+            std::cout << "\n";
+        }
+    }
+
+    std::cout << "\nsnapshot: huge pattern\n";
+    {
+        char path[] = "/tmp/aho-corasick-bench-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd == -1) {
+            std::cerr << "Cannot create a temporary file" << std::endl;
+            return 1;
+        }
+        close(fd);
+        std::unique_ptr<Automaton> built;
+        double build = Seconds([&]() {
+            built.reset(new Automaton(workloads[2].pattern, BuildMode::kEager));
+        });
+        built->SaveSnapshot(path);
+        std::unique_ptr<Automaton> loaded;
+        double load = Seconds([&]() {
+            loaded = Automaton::LoadSnapshot(path);
+        });
+        unlink(path);
+        std::cout << "  build " << build << " s, LoadSnapshot " << load << " s" << (loaded ? "" : " (failed)") << "\n";
+    }
+    return 0;
 }
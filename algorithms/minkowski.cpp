@@ -1,8 +1,32 @@
 /* Даны два выпуклых многоугольника на плоскости. В первом n точек, во втором m.
  * Определите, пересекаются ли они за O(n + m).
+ * Пакетный режим: "polygons_file pairs_file [threads]" - в первом файле число многоугольников и
+ * сами многоугольники в том же формате, во втором число запросов и пары номеров (с нуля);
+ * на каждую пару печатается YES или NO на отдельной строке.
+ * Если вместо pairs_file указан "-", печатаются все пересекающиеся пары "i j" (i < j) по возрастанию.
+ * С ключом "--distance" после YES или NO печатается строка "distance dx dy": расстояние между
+ * многоугольниками (или глубина проникновения) и направление сдвига первого до касания.
+ * С ключом "--hull" (в обоих режимах) точки многоугольника могут идти в любом порядке, лежать внутри
+ * и повторяться: сначала строится их выпуклая оболочка (ConvexHull).
+ * "--points points_file": со стандартного ввода один многоугольник в том же формате, в файле число
+ * точек и сами точки; на каждую точку печатается YES (внутри или на границе) или NO (ConvexRegion).
+ * "--bench [threads]" - замеры на синтетических многоугольниках (RunBenchmarks), ввод не читается.
  */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -13,6 +37,23 @@ using std::vector;
 
 const static double PI = 3.14159265358;
 const static double EPS = 0.00000000001;
+// Относительная погрешность, ниже которой векторное произведение в double считается нулем.
+const static double CROSS_RELATIVE_EPS = 0.000000000001;
+// Целые координаты не больше 2^52 по модулю: разности считаются в double без округления,
+// а их произведения точно помещаются в __int128.
+const static double EXACT_COORDINATE_LIMIT = 4503599627370496.0;
+
+/* Способ вычисления знака векторного произведения: в double с относительной погрешностью
+ * или точно в целых числах (годится, только если все координаты целые).
+ */
+enum Arithmetic {
+    kFloating,
+    kExactInteger
+};
+
+bool IsExactCoordinate(double coordinate) {
+    return coordinate == std::floor(coordinate) && std::fabs(coordinate) <= EXACT_COORDINATE_LIMIT;
+}
 
 
 class Point {
@@ -31,7 +72,7 @@ public:
         (*this).x_ = other.x_;
         return *this;
     }
-    bool operator == (const Point& other) {
+    bool operator == (const Point& other) const {
         return x_ == other.x_ && y_ == other.y_;
     }
     double Angle() const;
@@ -83,6 +124,46 @@ double Point::Angle() const {
     }
 }
 
+int CrossSign(const Point& a, const Point& b, Arithmetic arithmetic) {
+    /* Знак векторного произведения [a, b]: 1, если b повернут от a против часовой стрелки,
+     * -1 - по часовой, 0 - векторы коллинеарны.
+     */
+    if (arithmetic == kExactInteger) {
+        __int128 product = static_cast<__int128>(static_cast<long long>(a.GetX())) * static_cast<long long>(b.GetY())
+                - static_cast<__int128>(static_cast<long long>(a.GetY())) * static_cast<long long>(b.GetX());
+        return (product > 0) - (product < 0);
+    }
+    double left = a.GetX() * b.GetY();
+    double right = a.GetY() * b.GetX();
+    double product = left - right;
+    double bound = CROSS_RELATIVE_EPS * (std::fabs(left) + std::fabs(right));
+    return (product > bound) - (product < -bound);
+}
+
+int HalfPlane(const Point& vector) {
+    /* 0 - полярный угол в [0, PI), 1 - в [PI, 2 * PI), как у Point::Angle(); нулевой вектор имеет угол 0.
+     */
+    return vector.GetY() < 0 || (vector.GetY() == 0 && vector.GetX() < 0);
+}
+
+int CompareEdgeAngles(const Point& a, bool a_wrapped, const Point& b, bool b_wrapped, Arithmetic arithmetic) {
+    /* Сравнивает полярные углы ребер без тригонометрии: сначала номер оборота (wrapped - ребро
+     * уже второго обхода, к углу прибавлено 2 * PI), затем полуплоскость, затем знак векторного
+     * произведения. -1 - угол a меньше, 1 - больше, 0 - равны.
+     */
+    if (a_wrapped != b_wrapped) {
+        return a_wrapped ? 1 : -1;
+    }
+    int half_a = HalfPlane(a);
+    int half_b = HalfPlane(b);
+    if (half_a != half_b) {
+        return half_a < half_b ? -1 : 1;
+    }
+    Point zero;
+    Point unit(1, 0);
+    return -CrossSign(a == zero ? unit : a, b == zero ? unit : b, arithmetic);
+}
+
 bool Point::IsToTheLeft(const Point& first, const Point& last) const {
     /* Проверяет, что данная точка лежит либо на отрезке [a,b],
      * либо в левой полуплоскости относительно луча ab (в направлении от a до b)
@@ -111,37 +192,47 @@ bool Point::IsToTheLeft(const Point& first, const Point& last) const {
     return a.Length() >= b.Length() + EPS;
 }
 
-vector<Point> MinkowskiSum(const vector<Point>& first, const vector<Point>& second) {
+template <class FirstVertex, class SecondVertex, class Visitor>
+bool MergeEdges(FirstVertex first, int vert_num_1, SecondVertex second, int vert_num_2,
+                Arithmetic arithmetic, Visitor visit) {
+    /* Слияние ребер двух многоугольников (против часовой стрелки, от нижней точки) по полярному углу.
+     * first(i), second(j) возвращают i-ю и j-ю вершины, индексы берутся по модулю числа вершин.
+     * visit получает вершины суммы по порядку; если visit вернул false, слияние прерывается
+     * и результат - false. Углы сравниваются через CompareEdgeAngles.
+     */
     int i = 0;
     int j = 0;
-    int vert_num_1 = first.size();
-    int vert_num_2 = second.size();
-    vector<Point> first_pol = first;
-    vector<Point> second_pol = second;
-    first_pol.push_back(first[0]);
-    first_pol.push_back(first[1]);
-    second_pol.push_back(second[0]);
-    second_pol.push_back(second[1]);
-    vector<Point> answer;
     while (i < vert_num_1 || j < vert_num_2) {
-        answer.push_back(first_pol[i] + second_pol[j]);
-        double angle_i = (first_pol[i + 1] - first_pol[i]).Angle();
-        if (i >= vert_num_1) {
-            angle_i += 2 * PI;
-        }
-        double angle_j = (second_pol[j + 1] - second_pol[j]).Angle();
-        if (j >= vert_num_2) {
-            angle_j += 2 * PI;
+        Point current_i = first(i % vert_num_1);
+        Point current_j = second(j % vert_num_2);
+        if (!visit(current_i + current_j)) {
+            return false;
         }
-        if (angle_i + EPS < angle_j) {
+        Point edge_i = first((i + 1) % vert_num_1) - current_i;
+        Point edge_j = second((j + 1) % vert_num_2) - current_j;
+        int order = CompareEdgeAngles(edge_i, i >= vert_num_1, edge_j, j >= vert_num_2, arithmetic);
+        if (order < 0) {
             ++i;
-        } else if (angle_i > angle_j + EPS) {
+        } else if (order > 0) {
             ++j;
         } else {
             ++i;
             ++j;
         }
     }
+    return true;
+}
+
+vector<Point> MinkowskiSum(const vector<Point>& first, const vector<Point>& second,
+                           Arithmetic arithmetic = kFloating) {
+    vector<Point> answer;
+    answer.reserve(first.size() + second.size());
+    MergeEdges([&first](int i) { return first[i]; }, first.size(),
+               [&second](int j) { return second[j]; }, second.size(),
+               arithmetic, [&answer](const Point& vertex) {
+        answer.push_back(vertex);
+        return true;
+    });
     return answer;
 }
 
@@ -179,31 +270,1376 @@ bool PointBelongsToPolygon(const Point &point, const vector<Point> &polygon) {
     return point.IsToTheLeft(polygon[polygon.size() - 1], polygon[0]);
 }
 
-int main() {
+class ConvexRegion {
+    /* Выпуклый многоугольник (вершины против часовой стрелки, как для PointBelongsToPolygon) для
+     * многократной проверки точек. Ребро i хранится структурой массивов: начало (origin_x_, origin_y_)
+     * и вектор (edge_x_, edge_y_), поэтому векторные произведения для восьми ребер считаются
+     * инструкциями AVX2 с выходом при первом отрицательном знаке. Произведение вычисляется теми же
+     * операциями, что в IsToTheLeft, а ребра, где оно по модулю не больше EPS, проверяются самим
+     * IsToTheLeft, так что ответы совпадают с PointBelongsToPolygon. Ядро (AVX2 или скалярное)
+     * выбирается при запуске по процессору; SSE2 по замерам (--bench) не быстрее скалярного цикла.
+     * Перебор ребер линеен, поэтому у многоугольника больше чем с LinearEdgeLimit(kernel) ребрами
+     * точка локализуется в веере (ConvexPolygonContains) за O(log n), как в
+     * PointBelongsToConvexPolygon: граница и там считается внутренней, отличие возможно только
+     * для точек в пределах погрешности округления от ребра.
+     */
+public:
+    enum Kernel {
+        kScalarKernel,
+        kAvx2Kernel
+    };
+
+    explicit ConvexRegion(const vector<Point>& polygon, Kernel kernel = BestKernel());
+    // linear_edge_limit вместо LinearEdgeLimit(kernel) - для замеров обоих способов на одном многоугольнике.
+    ConvexRegion(const vector<Point>& polygon, Kernel kernel, size_t linear_edge_limit);
+    static Kernel BestKernel();
+    static size_t LinearEdgeLimit(Kernel kernel);
+
+    bool Contains(const Point& point) const;
+    void Classify(const double* xs, const double* ys, size_t count, char* inside) const;
+
+private:
+    vector<Point> polygon_;
+    vector<double> origin_x_;
+    vector<double> origin_y_;
+    vector<double> edge_x_;
+    vector<double> edge_y_;
+    Kernel kernel_;
+    bool fan_;
+    // Все вершины целые и не больше EXACT_COORDINATE_LIMIT: для целой точки веер считается точно.
+    bool exact_;
+
+    bool EdgeAdmits(size_t edge, double x, double y) const {
+        return Point(x, y).IsToTheLeft(polygon_[edge], polygon_[edge + 1 == polygon_.size() ? 0 : edge + 1]);
+    }
+    bool ContainsScalar(double x, double y, size_t begin) const;
+    bool ContainsFan(double x, double y) const;
+#if defined(__x86_64__) || defined(__i386__)
+    bool ContainsAvx2(double x, double y) const;
+#endif
+};
+
+int Orientation(const Point& origin, const Point& a, const Point& b, Arithmetic arithmetic) {
+    /* Знак векторного произведения [a - origin, b - origin]. В точном режиме координаты сначала
+     * переводятся в целые, так что и разности, и произведения считаются без округления.
+     */
+    if (arithmetic == kExactInteger) {
+        long long ox = static_cast<long long>(origin.GetX());
+        long long oy = static_cast<long long>(origin.GetY());
+        __int128 product = static_cast<__int128>(static_cast<long long>(a.GetX()) - ox)
+                * (static_cast<long long>(b.GetY()) - oy)
+                - static_cast<__int128>(static_cast<long long>(a.GetY()) - oy)
+                * (static_cast<long long>(b.GetX()) - ox);
+        return (product > 0) - (product < 0);
+    }
+    return CrossSign(a - origin, b - origin, kFloating);
+}
+
+bool OnSegment(const Point& first, const Point& last, const Point& point, Arithmetic arithmetic) {
+    /* Лежит ли point, коллинеарная отрезку [first, last], между его концами.
+     */
+    if (arithmetic == kExactInteger) {
+        long long fx = static_cast<long long>(first.GetX()), fy = static_cast<long long>(first.GetY());
+        long long lx = static_cast<long long>(last.GetX()), ly = static_cast<long long>(last.GetY());
+        long long px = static_cast<long long>(point.GetX()), py = static_cast<long long>(point.GetY());
+        return static_cast<__int128>(px - fx) * (lx - fx) + static_cast<__int128>(py - fy) * (ly - fy) >= 0
+               && static_cast<__int128>(px - lx) * (fx - lx) + static_cast<__int128>(py - ly) * (fy - ly) >= 0;
+    }
+    Point to_last = last - first;
+    Point from_first = point - first;
+    Point from_last = point - last;
+    return from_first.GetX() * to_last.GetX() + from_first.GetY() * to_last.GetY() >= -EPS
+           && from_last.GetX() * to_last.GetX() + from_last.GetY() * to_last.GetY() <= EPS;
+}
+
+template <class Vertex>
+bool ConvexPolygonContains(Vertex vertex, int size, const Point& point, Arithmetic arithmetic) {
+    /* Локализация точки в веере треугольников из вершины 0 выпуклого многоугольника (вершины против
+     * часовой стрелки, vertex(k) - k-я). Двоичным поиском находится последняя вершина k, левее
+     * луча к которой (или на нем) лежит point, затем point проверяется относительно ребра (k, k + 1).
+     * Соседние вершины могут лежать на одной прямой. Граница считается принадлежащей многоугольнику.
+     * O(log size) обращений к vertex.
+     */
+    Point origin = vertex(0);
+    if (size == 1) {
+        return point == origin;
+    }
+    Point last = vertex(size - 1);
+    int last_side = Orientation(origin, last, point, arithmetic);
+    if (size == 2) {
+        return last_side == 0 && OnSegment(origin, last, point, arithmetic);
+    }
+    if (Orientation(origin, vertex(1), point, arithmetic) < 0 || last_side > 0) {
+        return false;
+    }
+    if (last_side == 0) {
+        // Последние вершины могут лежать на одной прямой с origin (параллельные ребра в сумме):
+        // point сравнивается с самой дальней из них - первой вершиной r, коллинеарной лучу к last.
+        int low = 0;
+        int high = size - 1;
+        while (high - low > 1) {
+            int middle = (low + high) / 2;
+            if (Orientation(origin, vertex(middle), last, arithmetic) > 0) {
+                low = middle;
+            } else {
+                high = middle;
+            }
+        }
+        return OnSegment(origin, vertex(high), point, arithmetic);
+    }
+    int low = 1;
+    int high = size - 1;
+    while (high - low > 1) {
+        int middle = (low + high) / 2;
+        if (Orientation(origin, vertex(middle), point, arithmetic) >= 0) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return Orientation(vertex(low), vertex(low + 1), point, arithmetic) >= 0;
+}
+
+bool PointBelongsToConvexPolygon(const Point& point, const vector<Point>& polygon, Arithmetic arithmetic = kFloating) {
+    /* То же, что PointBelongsToPolygon, за O(log n): polygon - результат SortVertices или MinkowskiSum.
+     */
+    return ConvexPolygonContains([&polygon](int k) { return polygon[k]; }, polygon.size(), point, arithmetic);
+}
+
+bool LexicographicLess(const Point& a, const Point& b) {
+    return a.GetX() < b.GetX() || (a.GetX() == b.GetX() && a.GetY() < b.GetY());
+}
+
+void ParallelSort(vector<Point>& points, unsigned int threads) {
+    /* Сортировка по (x, y): массив делится на threads кусков, каждый сортируется в своем потоке,
+     * затем соседние куски сливаются попарно, тоже параллельно, за log(threads) раундов.
+     */
+    const size_t kMinChunk = 1 << 16;
+    size_t n = points.size();
+    if (threads == 0) {
+        threads = 1;
+    }
+    threads = std::min<size_t>(threads, std::max<size_t>(1, n / kMinChunk));
+    vector<size_t> bounds;
+    for (unsigned int t = 0; t <= threads; ++t) {
+        bounds.push_back(n * t / threads);
+    }
+    auto sort_chunk = [&points, &bounds](size_t t) {
+        std::sort(points.begin() + bounds[t], points.begin() + bounds[t + 1], LexicographicLess);
+    };
+    vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(sort_chunk, t);
+    }
+    sort_chunk(0);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    for (size_t width = 1; width < threads; width *= 2) {
+        auto merge_chunks = [&points, &bounds, width, threads](size_t t) {
+            size_t middle = std::min<size_t>(t + width, threads);
+            size_t end = std::min<size_t>(t + 2 * width, threads);
+            std::inplace_merge(points.begin() + bounds[t], points.begin() + bounds[middle],
+                               points.begin() + bounds[end], LexicographicLess);
+        };
+        workers.clear();
+        for (size_t t = 2 * width; t + width < threads; t += 2 * width) {
+            workers.emplace_back(merge_chunks, t);
+        }
+        merge_chunks(0);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+}
+
+vector<Point> ConvexHull(vector<Point> points, unsigned int threads = 1, Arithmetic arithmetic = kFloating) {
+    /* Выпуклая оболочка произвольного набора точек (монотонная цепочка Эндрю) в том виде, который
+     * ждет MinkowskiSum: против часовой стрелки от нижней (из нижних - левой) вершины, без повторов
+     * и без точек на сторонах. Если точки уже отсортированы по (x, y), сортировка пропускается
+     * и оболочка строится одним проходом. O(n log n / threads + n).
+     */
+    if (!std::is_sorted(points.begin(), points.end(), LexicographicLess)) {
+        ParallelSort(points, threads);
+    }
+    vector<Point> hull;
+    // Нижняя цепочка слева направо, затем верхняя справа налево; совпадающие точки стоят рядом.
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (i > 0 && points[i] == points[i - 1]) {
+            continue;
+        }
+        while (hull.size() >= 2 && Orientation(hull[hull.size() - 2], hull.back(), points[i], arithmetic) <= 0) {
+            hull.pop_back();
+        }
+        hull.push_back(points[i]);
+    }
+    if (hull.size() <= 1) {
+        return hull;
+    }
+    size_t lower_size = hull.size();
+    for (size_t i = points.size() - 1; i-- > 0;) {
+        if (points[i] == points[i + 1]) {
+            continue;
+        }
+        while (hull.size() > lower_size && Orientation(hull[hull.size() - 2], hull.back(), points[i], arithmetic) <= 0) {
+            hull.pop_back();
+        }
+        hull.push_back(points[i]);
+    }
+    hull.pop_back();
+    size_t lowest = 0;
+    for (size_t i = 1; i < hull.size(); ++i) {
+        if (hull[i].GetY() < hull[lowest].GetY()
+                || (hull[i].GetY() == hull[lowest].GetY() && hull[i].GetX() < hull[lowest].GetX())) {
+            lowest = i;
+        }
+    }
+    std::rotate(hull.begin(), hull.begin() + lowest, hull.end());
+    return hull;
+}
+
+/* Расстояние между многоугольниками A и B через S = A + (-B): если A и B не пересекаются,
+ * distance - расстояние между ними, иначе - глубина проникновения. Сдвиг A на
+ * distance * direction (direction - единичный вектор) приводит A и B к касанию: в первом случае
+ * сближает, во втором раздвигает. edge - номер ребра S, на котором лежит ближайшая точка.
+ */
+struct Proximity {
+    bool intersect;
+    double distance;
+    Point direction;
+    int edge;
+};
+
+double InsideDistance(const Point& first, const Point& last, const Point& point) {
+    /* Расстояние со знаком от point до прямой ребра [first, last]: плюс - слева, внутри
+     * многоугольника против часовой стрелки.
+     */
+    Point edge = last - first;
+    Point offset = point - first;
+    return (edge.GetX() * offset.GetY() - edge.GetY() * offset.GetX())
+           / std::sqrt(edge.GetX() * edge.GetX() + edge.GetY() * edge.GetY());
+}
+
+double EdgeProjection(const Point& first, const Point& last, const Point& point) {
+    /* Параметр проекции point на прямую ребра: 0 - first, 1 - last.
+     */
+    Point edge = last - first;
+    Point offset = point - first;
+    return (edge.GetX() * offset.GetX() + edge.GetY() * offset.GetY())
+           / (edge.GetX() * edge.GetX() + edge.GetY() * edge.GetY());
+}
+
+Proximity TouchingShift(bool intersect, const Point& point, const Point& nearest, const Point& normal, int edge) {
+    /* Сдвиг point - nearest переводит point на границу; если point уже на ней, сдвиг идет по normal.
+     */
+    Point shift = point - nearest;
+    double length = std::sqrt(shift.GetX() * shift.GetX() + shift.GetY() * shift.GetY());
+    if (length == 0) {
+        return {intersect, 0.0, normal, edge};
+    }
+    return {intersect, length, Point(shift.GetX() / length, shift.GetY() / length), edge};
+}
+
+Proximity EdgeProximity(const vector<Point>& polygon, int edge, const Point& point) {
+    /* Ближайшая к point точка ребра edge как отрезка (случай, когда point вне многоугольника).
+     */
+    const Point& first = polygon[edge];
+    const Point& last = polygon[(edge + 1) % polygon.size()];
+    double t = std::min(1.0, std::max(0.0, EdgeProjection(first, last, point)));
+    Point nearest(first.GetX() + t * (last.GetX() - first.GetX()), first.GetY() + t * (last.GetY() - first.GetY()));
+    Point edge_vector = last - first;
+    double length = std::sqrt(edge_vector.GetX() * edge_vector.GetX() + edge_vector.GetY() * edge_vector.GetY());
+    return TouchingShift(false, point, nearest, Point(-edge_vector.GetY() / length, edge_vector.GetX() / length), edge);
+}
+
+Proximity PointProximity(const vector<Point>& polygon, const Point& point) {
+    /* Расстояние от point до выпуклого многоугольника (против часовой стрелки, без повторяющихся
+     * вершин) за O(n). Для S = MinkowskiSum(A, -B) и point = (0, 0) это расстояние между A и B
+     * или глубина их взаимного проникновения.
+     */
+    int n = polygon.size();
+    int nearest_edge = 0;
+    double nearest = INFINITY;
+    for (int i = 0; i < n; ++i) {
+        double distance = InsideDistance(polygon[i], polygon[(i + 1) % n], point);
+        if (distance < nearest) {
+            nearest = distance;
+            nearest_edge = i;
+        }
+    }
+    if (n >= 3 && nearest >= 0) {
+        const Point& first = polygon[nearest_edge];
+        Point edge_vector = polygon[(nearest_edge + 1) % n] - first;
+        double length = std::sqrt(edge_vector.GetX() * edge_vector.GetX() + edge_vector.GetY() * edge_vector.GetY());
+        Point normal(-edge_vector.GetY() / length, edge_vector.GetX() / length);
+        return {true, nearest, normal, nearest_edge};
+    }
+    Proximity best = EdgeProximity(polygon, 0, point);
+    for (int i = 1; i < n; ++i) {
+        Proximity current = EdgeProximity(polygon, i, point);
+        if (current.distance < best.distance) {
+            best = current;
+        }
+    }
+    return best;
+}
+
+/* Ограничивающий прямоугольник многоугольника с номером polygon в PolygonSet.
+ */
+struct BoundingBox {
+    double min_x;
+    double max_x;
+    double min_y;
+    double max_y;
+    size_t polygon;
+};
+
+class PolygonSet {
+    /* Набор выпуклых многоугольников в виде структуры массивов: координаты всех вершин подряд
+     * в xs_ и ys_, многоугольник k занимает [offsets_[k], offsets_[k + 1]). Вершины хранятся
+     * против часовой стрелки начиная с нижней (из нижних - левой); top_[k] - номер верхней
+     * (из верхних - правой) вершины, с нее начинается отраженный многоугольник -P.
+     * Запросы только читают набор, поэтому их можно задавать из нескольких потоков.
+     */
+public:
+    PolygonSet() : offsets_(1, 0), arithmetic_(kExactInteger) {}
+
+    size_t Add(const vector<Point>& clockwise);
+    size_t Size() const {
+        return offsets_.size() - 1;
+    }
+    bool Contains(size_t polygon, const Point& point) const;
+    BoundingBox Bounds(size_t polygon) const;
+    void Translate(size_t polygon, const Point& shift);
+    bool Intersect(size_t first, size_t second) const;
+    bool IntersectByMerge(size_t first, size_t second) const;
+    vector<char> IntersectPairs(const vector<std::pair<size_t, size_t> >& pairs, unsigned int threads) const;
+
+private:
+    vector<double> xs_;
+    vector<double> ys_;
+    vector<size_t> offsets_;
+    vector<size_t> top_;
+    Arithmetic arithmetic_;
+};
+
+class BroadPhase {
+    /* Отбор пар-кандидатов по ограничивающим прямоугольникам (sweep and prune) перед точной
+     * проверкой PolygonSet::Intersect. Прямоугольники хранятся отсортированными по min_x; при
+     * проходе слева направо каждый сравнивается только с теми, чей min_x не больше его max_x.
+     * Сдвинутые многоугольники отмечаются через Update и при следующем запросе вынимаются из
+     * порядка, сортируются отдельно и вливаются обратно за O(N + k log k), k - число сдвинутых.
+     */
+public:
+    explicit BroadPhase(const PolygonSet& polygons);
+
+    void Update(size_t polygon);
+    vector<std::pair<size_t, size_t> > CandidatePairs();
+    vector<std::pair<size_t, size_t> > IntersectingPairs(unsigned int threads);
+
+private:
+    void Restore();
+
+    const PolygonSet& polygons_;
+    vector<BoundingBox> boxes_;
+    vector<size_t> position_;
+    vector<size_t> moved_;
+};
+
+class ProximityTracker {
+    /* Повторные запросы PointProximity для пары многоугольников, которые только сдвигаются:
+     * S = A + (-B) строится один раз, а сдвиг A относительно B равносилен сдвигу точки запроса
+     * на -shift. Каждый запрос начинается с ребра прошлого ответа.
+     * Снаружи: если point правее ребра и проецируется на него, ближайшая точка этого ребра -
+     * ближайшая во всем S; если проекция за концом, шаг к соседнему ребру, пока point не попадет
+     * в нормальный конус вершины. Шаги идут в одну сторону, при малом сдвиге их O(1).
+     * Точка на прямой ребра снаружи не считается: как и в PointProximity, касание - это пересечение.
+     * Внутри: глубина - наименьшее из расстояний support_[j] - (normals_[j], point) до прямых ребер.
+     * Оно ищется ветвями и границами по дереву отрезков над ребрами: нормали ребер отсортированы
+     * по углу, и для отрезка ребер (normals_[j], point) не больше, чем для ближайшего к направлению
+     * point конца дуги. Ребро прошлого ответа дает начальную границу, так что просматриваются
+     * только ветви, где глубина может быть меньше.
+     */
+public:
+    explicit ProximityTracker(const vector<Point>& sum);
+
+    Proximity Query(const Point& shift);
+
+private:
+    bool WalkOutside(int edge, const Point& point, Proximity& result) const;
+    void SearchNearestLine(size_t node, size_t begin, size_t end, const Point& point,
+                           int& nearest, double& distance) const;
+    double LineDistance(int edge, const Point& point) const {
+        return support_[edge] - (normals_[edge].GetX() * point.GetX() + normals_[edge].GetY() * point.GetY());
+    }
+    double MaxNormalProjection(size_t first, size_t last, const Point& point) const;
+
+    vector<Point> sum_;
+    vector<Point> normals_;
+    vector<double> support_;
+    vector<double> min_support_;
+    size_t leaves_;
+    Proximity last_;
+};
+
+bool ReadPolygon(std::istream& input, vector<Point>& polygon, Arithmetic& arithmetic) {
+    /* Число вершин n и n пар координат. false, если вход оборван или не число, а также при n < 1:
+     * пустой многоугольник дошел бы до индексов по модулю числа вершин. Нецелая или слишком большая
+     * координата переключает arithmetic на kFloating.
+     */
     int n;
-    cin >> n;
-    vector<Point> first_polygon;
+    if (!(input >> n) || n < 1) {
+        return false;
+    }
+    polygon.clear();
     for (int i = 0; i < n; ++i) {
         double x, y;
-        cin >> x >> y;
-        first_polygon.emplace_back(x, y);
+        if (!(input >> x >> y)) {
+            return false;
+        }
+        if (!IsExactCoordinate(x) || !IsExactCoordinate(y)) {
+            arithmetic = kFloating;
+        }
+        polygon.emplace_back(x, y);
+    }
+    return true;
+}
+
+bool ParseThreads(const std::string& text, unsigned int& threads) {
+    /* Число потоков - целое не меньше 1 без лишних символов; больше четырех потоков на ядро
+     * пакетному режиму не нужно, такое число урезается.
+     */
+    const unsigned long kMaxThreadsPerCore = 4;
+    char* end;
+    long value = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || value < 1) {
+        return false;
+    }
+    unsigned long limit = kMaxThreadsPerCore * std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned int>(std::min<unsigned long>(value, limit));
+    return true;
+}
+
+int RunBenchmarks(unsigned int threads);
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+        if (argc > 2 && !ParseThreads(argv[2], threads)) {
+            std::cerr << "Bad thread count " << argv[2] << endl;
+            return 1;
+        }
+        return RunBenchmarks(threads);
+    }
+    bool distance = false;
+    bool hull = false;
+    std::string points_path;
+    vector<std::string> arguments;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "--distance") {
+            distance = true;
+        } else if (argument == "--hull") {
+            hull = true;
+        } else if (argument == "--points" && i + 1 < argc) {
+            points_path = argv[++i];
+        } else {
+            arguments.push_back(argument);
+        }
+    }
+    if (!points_path.empty()) {
+        Arithmetic arithmetic = kExactInteger;
+        vector<Point> polygon;
+        if (!ReadPolygon(cin, polygon, arithmetic)) {
+            std::cerr << "Cannot read polygon: need a vertex count of at least 1 and that many points" << endl;
+            return 1;
+        }
+        polygon = hull ? ConvexHull(polygon, 1, arithmetic) : SortVertices(polygon);
+        std::ifstream points_input(points_path);
+        size_t count = 0;
+        if (!(points_input >> count)) {
+            std::cerr << "Cannot read point count from " << points_path << endl;
+            return 1;
+        }
+        vector<double> xs, ys;
+        for (size_t k = 0; k < count; ++k) {
+            double x, y;
+            if (!(points_input >> x >> y)) {
+                std::cerr << "Cannot read point " << k << " from " << points_path << endl;
+                return 1;
+            }
+            xs.push_back(x);
+            ys.push_back(y);
+        }
+        vector<char> inside(count);
+        ConvexRegion(polygon).Classify(xs.data(), ys.data(), count, inside.data());
+        for (char answer : inside) {
+            cout << (answer ? "YES\n" : "NO\n");
+        }
+        return 0;
+    }
+    if (arguments.size() > 1) {
+        bool all_pairs = arguments[1] == "-";
+        std::ifstream polygons_input(arguments[0]);
+        std::ifstream pairs_input;
+        if (!all_pairs) {
+            pairs_input.open(arguments[1]);
+        }
+        if (!polygons_input || (!all_pairs && !pairs_input)) {
+            std::cerr << "Cannot read " << (polygons_input ? arguments[1] : arguments[0]) << endl;
+            return 1;
+        }
+        // Оборванный файл и многоугольник без вершин - ошибка, как и неверные пары ниже.
+        PolygonSet polygons;
+        size_t count;
+        if (!(polygons_input >> count)) {
+            std::cerr << "Cannot read polygon count from " << arguments[0] << endl;
+            return 1;
+        }
+        vector<Point> polygon;
+        for (size_t k = 0; k < count; ++k) {
+            Arithmetic arithmetic = kExactInteger;
+            if (!ReadPolygon(polygons_input, polygon, arithmetic)) {
+                std::cerr << "Cannot read polygon " << k << " from " << arguments[0]
+                          << ": need a vertex count of at least 1 and that many points" << endl;
+                return 1;
+            }
+            if (hull) {
+                // Оболочка идет против часовой стрелки, а Add ждет вершины по часовой.
+                polygon = ConvexHull(polygon, 1, arithmetic);
+                std::reverse(polygon.begin(), polygon.end());
+            }
+            polygons.Add(polygon);
+        }
+        unsigned int threads = std::thread::hardware_concurrency();
+        if (arguments.size() > 2 && !ParseThreads(arguments[2], threads)) {
+            std::cerr << "Bad thread count " << arguments[2] << endl;
+            return 1;
+        }
+        if (all_pairs) {
+            BroadPhase broad_phase(polygons);
+            for (const std::pair<size_t, size_t>& pair : broad_phase.IntersectingPairs(threads)) {
+                cout << pair.first << ' ' << pair.second << '\n';
+            }
+            return 0;
+        }
+        // Номера вне [0, polygons.Size()) и оборванный файл - ошибка, а не чтение мимо набора.
+        size_t queries = 0;
+        pairs_input >> queries;
+        vector<std::pair<size_t, size_t> > pairs;
+        for (size_t q = 0; q < queries; ++q) {
+            std::pair<size_t, size_t> pair;
+            if (!(pairs_input >> pair.first >> pair.second)) {
+                std::cerr << "Cannot read pair " << q << " from " << arguments[1] << endl;
+                return 1;
+            }
+            if (pair.first >= polygons.Size() || pair.second >= polygons.Size()) {
+                std::cerr << "Pair " << q << " (" << pair.first << ", " << pair.second << ") is out of range: "
+                          << polygons.Size() << " polygons" << endl;
+                return 1;
+            }
+            pairs.push_back(pair);
+        }
+        vector<char> answers = polygons.IntersectPairs(pairs, threads);
+        for (char answer : answers) {
+            cout << (answer ? "YES\n" : "NO\n");
+        }
+        return 0;
     }
 
-    int m;
-    cin >> m;
+    /* Если все координаты целые и не слишком большие, углы ребер сравниваются точно. */
+    Arithmetic arithmetic = kExactInteger;
+    vector<Point> first_polygon;
     vector<Point> second_polygon;
-    for (int i = 0; i < m; ++i) {
-        double x, y;
-        cin >> x >> y;
-        second_polygon.emplace_back(-x, -y);
+    if (!ReadPolygon(cin, first_polygon, arithmetic) || !ReadPolygon(cin, second_polygon, arithmetic)) {
+        std::cerr << "Cannot read polygons: need a vertex count of at least 1 and that many points" << endl;
+        return 1;
+    }
+    for (Point& vertex : second_polygon) {
+        vertex = Point(-vertex.GetX(), -vertex.GetY());
+    }
+    if (hull) {
+        // ConvexHull сразу дает порядок, который ждет MinkowskiSum.
+        first_polygon = ConvexHull(first_polygon, 1, arithmetic);
+        second_polygon = ConvexHull(second_polygon, 1, arithmetic);
+    } else {
+        first_polygon = SortVertices(first_polygon);
+        second_polygon = SortVertices(second_polygon);
     }
-    first_polygon = SortVertices(first_polygon);
-    second_polygon = SortVertices(second_polygon);
-    vector<Point> answer = MinkowskiSum(first_polygon, second_polygon);
+    vector<Point> answer = MinkowskiSum(first_polygon, second_polygon, arithmetic);
     Point zero;
     if (PointBelongsToPolygon(zero, answer)) {
         cout << "YES";
     } else {
         cout << "NO";
     }
+    if (distance) {
+        Proximity proximity = PointProximity(answer, zero);
+        cout << '\n' << proximity.distance << ' ' << proximity.direction.GetX() << ' ' << proximity.direction.GetY();
+    }
+}
+
+size_t PolygonSet::Add(const vector<Point>& clockwise) {
+    /* Вершины (хотя бы одна) подаются по часовой стрелке, как в main; возвращает номер
+     * многоугольника в наборе.
+     */
+    int n = clockwise.size();
+    int lowest = 0;
+    for (int i = 1; i < n; ++i) {
+        const Point& current = clockwise[i];
+        const Point& best = clockwise[lowest];
+        if (current.GetY() < best.GetY() || (current.GetY() == best.GetY() && current.GetX() < best.GetX())) {
+            lowest = i;
+        }
+    }
+    size_t begin = xs_.size();
+    size_t top = begin;
+    for (int step = 0; step < n; ++step) {
+        const Point& vertex = clockwise[((lowest - step) % n + n) % n];
+        double x = vertex.GetX();
+        double y = vertex.GetY();
+        if (!IsExactCoordinate(x) || !IsExactCoordinate(y)) {
+            arithmetic_ = kFloating;
+        }
+        if (step == 0 || y > ys_[top] || (y == ys_[top] && x > xs_[top])) {
+            top = xs_.size();
+        }
+        xs_.push_back(x);
+        ys_.push_back(y);
+    }
+    offsets_.push_back(xs_.size());
+    top_.push_back(top - begin);
+    return Size() - 1;
+}
+
+bool PolygonSet::Contains(size_t polygon, const Point& point) const {
+    size_t begin = offsets_[polygon];
+    return ConvexPolygonContains([this, begin](int k) {
+        return Point(xs_[begin + k], ys_[begin + k]);
+    }, offsets_[polygon + 1] - begin, point, arithmetic_);
+}
+
+bool PolygonSet::Intersect(size_t first, size_t second) const {
+    /* Многоугольники пересекаются, если начало координат лежит в S = first + (-second). S не строится:
+     * если при слиянии ребер равные по углу ребра брать сначала из first, то k-я вершина S равна
+     * a(i) + b(k - i), где i - число ребер first среди первых k ребер слияния. i находится двоичным
+     * поиском по двум возрастающим последовательностям углов, после чего начало координат
+     * локализуется в веере S (ConvexPolygonContains). Итого O(log(n + m) * log(min(n, m)))
+     * после предобработки в Add, против O(n + m) у IntersectByMerge.
+     */
+    size_t first_begin = offsets_[first];
+    size_t second_begin = offsets_[second];
+    int n = offsets_[first + 1] - first_begin;
+    int m = offsets_[second + 1] - second_begin;
+    size_t second_top = top_[second];
+    auto a = [this, first_begin, n](int i) {
+        size_t k = first_begin + i % n;
+        return Point(xs_[k], ys_[k]);
+    };
+    auto b = [this, second_begin, second_top, m](int j) {
+        size_t k = second_begin + (second_top + j) % m;
+        return Point(-xs_[k], -ys_[k]);
+    };
+    auto sum_vertex = [&](int k) {
+        int low = std::max(0, k - m);
+        int high = std::min(k, n);
+        // Наибольшее i, при котором ребро i - 1 первого идет не позже ребра k - i второго.
+        while (low < high) {
+            int i = (low + high + 1) / 2;
+            int j = k - i;
+            if (j < m && CompareEdgeAngles(a(i) - a(i - 1), false, b(j + 1) - b(j), false, arithmetic_) > 0) {
+                high = i - 1;
+            } else {
+                low = i;
+            }
+        }
+        return a(low) + b(k - low);
+    };
+    return ConvexPolygonContains(sum_vertex, n + m, Point(), arithmetic_);
+}
+
+bool PolygonSet::IntersectByMerge(size_t first, size_t second) const {
+    /* Многоугольники пересекаются, если начало координат лежит в first + (-second). Сумма не
+     * строится: каждое ее ребро проверяется сразу, как только получено, и при первом ребре,
+     * справа от которого лежит начало координат, ответ - нет. Память на запрос не выделяется.
+     */
+    size_t first_begin = offsets_[first];
+    size_t second_begin = offsets_[second];
+    int first_size = offsets_[first + 1] - first_begin;
+    int second_size = offsets_[second + 1] - second_begin;
+    size_t second_top = top_[second];
+    Point zero;
+    Point first_vertex;
+    Point previous;
+    bool started = false;
+    bool inside = MergeEdges(
+            [this, first_begin](int i) {
+                return Point(xs_[first_begin + i], ys_[first_begin + i]);
+            }, first_size,
+            [this, second_begin, second_top, second_size](int j) {
+                size_t k = second_begin + (second_top + j) % second_size;
+                return Point(-xs_[k], -ys_[k]);
+            }, second_size,
+            arithmetic_, [&](const Point& vertex) {
+                if (!started) {
+                    started = true;
+                    first_vertex = vertex;
+                } else if (!zero.IsToTheLeft(previous, vertex)) {
+                    return false;
+                }
+                previous = vertex;
+                return true;
+            });
+    return inside && zero.IsToTheLeft(previous, first_vertex);
+}
+
+vector<char> PolygonSet::IntersectPairs(const vector<std::pair<size_t, size_t> >& pairs, unsigned int threads) const {
+    /* Ответы на пачку запросов в порядке входа: пары делятся на threads равных отрезков,
+     * каждый поток пишет только в свой отрезок результата.
+     */
+    vector<char> answers(pairs.size(), 0);
+    if (threads == 0) {
+        threads = 1;
+    }
+    size_t step = (pairs.size() + threads - 1) / threads;
+    auto work = [&](size_t begin, size_t end) {
+        for (size_t q = begin; q < end; ++q) {
+            answers[q] = Intersect(pairs[q].first, pairs[q].second);
+        }
+    };
+    vector<std::thread> workers;
+    for (unsigned int t = 1; t < threads && t * step < pairs.size(); ++t) {
+        workers.emplace_back(work, t * step, std::min(pairs.size(), (t + 1) * step));
+    }
+    work(0, std::min(pairs.size(), step));
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return answers;
+}
+
+BoundingBox PolygonSet::Bounds(size_t polygon) const {
+    /* Нижняя вершина многоугольника - первая, верхняя - top_; крайние по x ищутся проходом.
+     */
+    size_t begin = offsets_[polygon];
+    size_t end = offsets_[polygon + 1];
+    BoundingBox box = {xs_[begin], xs_[begin], ys_[begin], ys_[begin + top_[polygon]], polygon};
+    for (size_t k = begin + 1; k < end; ++k) {
+        box.min_x = std::min(box.min_x, xs_[k]);
+        box.max_x = std::max(box.max_x, xs_[k]);
+    }
+    return box;
+}
+
+void PolygonSet::Translate(size_t polygon, const Point& shift) {
+    /* Сдвиг не меняет ни нижнюю, ни верхнюю вершину, так что порядок вершин и top_ остаются прежними.
+     */
+    for (size_t k = offsets_[polygon]; k < offsets_[polygon + 1]; ++k) {
+        xs_[k] += shift.GetX();
+        ys_[k] += shift.GetY();
+        if (!IsExactCoordinate(xs_[k]) || !IsExactCoordinate(ys_[k])) {
+            arithmetic_ = kFloating;
+        }
+    }
+}
+
+bool MinXLess(const BoundingBox& a, const BoundingBox& b) {
+    return a.min_x < b.min_x;
+}
+
+BroadPhase::BroadPhase(const PolygonSet& polygons) : polygons_(polygons) {
+    for (size_t polygon = 0; polygon < polygons_.Size(); ++polygon) {
+        boxes_.push_back(polygons_.Bounds(polygon));
+    }
+    std::sort(boxes_.begin(), boxes_.end(), MinXLess);
+    position_.resize(boxes_.size());
+    for (size_t k = 0; k < boxes_.size(); ++k) {
+        position_[boxes_[k].polygon] = k;
+    }
+}
+
+void BroadPhase::Update(size_t polygon) {
+    /* Вызывается после PolygonSet::Translate; для многоугольника, добавленного в набор после
+     * построения индекса, - после PolygonSet::Add.
+     */
+    while (position_.size() <= polygon) {
+        position_.push_back(boxes_.size());
+        boxes_.push_back(polygons_.Bounds(position_.size() - 1));
+        moved_.push_back(position_.size() - 1);
+    }
+    boxes_[position_[polygon]] = polygons_.Bounds(polygon);
+    moved_.push_back(polygon);
+}
+
+void BroadPhase::Restore() {
+    /* Сдвинутые прямоугольники вынимаются из boxes_ (остальные сохраняют порядок),
+     * сортируются и сливаются с остальными.
+     */
+    if (moved_.empty()) {
+        return;
+    }
+    const size_t kMoved = boxes_.size();
+    vector<BoundingBox> moved;
+    for (size_t polygon : moved_) {
+        if (position_[polygon] != kMoved) {
+            moved.push_back(boxes_[position_[polygon]]);
+            position_[polygon] = kMoved;
+        }
+    }
+    moved_.clear();
+    size_t kept = 0;
+    for (size_t k = 0; k < boxes_.size(); ++k) {
+        if (position_[boxes_[k].polygon] != kMoved) {
+            boxes_[kept++] = boxes_[k];
+        }
+    }
+    std::sort(moved.begin(), moved.end(), MinXLess);
+    vector<BoundingBox> merged(boxes_.size());
+    std::merge(boxes_.begin(), boxes_.begin() + kept, moved.begin(), moved.end(), merged.begin(), MinXLess);
+    boxes_.swap(merged);
+    for (size_t k = 0; k < boxes_.size(); ++k) {
+        position_[boxes_[k].polygon] = k;
+    }
+}
+
+vector<std::pair<size_t, size_t> > BroadPhase::CandidatePairs() {
+    /* Пары (i, j), i < j, чьи прямоугольники пересекаются (касание с допуском EPS тоже считается).
+     */
+    Restore();
+    vector<std::pair<size_t, size_t> > candidates;
+    for (size_t k = 0; k < boxes_.size(); ++k) {
+        const BoundingBox& current = boxes_[k];
+        for (size_t l = k + 1; l < boxes_.size() && boxes_[l].min_x <= current.max_x + EPS; ++l) {
+            const BoundingBox& other = boxes_[l];
+            if (other.min_y <= current.max_y + EPS && current.min_y <= other.max_y + EPS) {
+                candidates.emplace_back(std::min(current.polygon, other.polygon),
+                                        std::max(current.polygon, other.polygon));
+            }
+        }
+    }
+    return candidates;
+}
+
+vector<std::pair<size_t, size_t> > BroadPhase::IntersectingPairs(unsigned int threads) {
+    /* Кандидаты проверяются точно (PolygonSet::IntersectPairs); ответ упорядочен по возрастанию пар.
+     */
+    vector<std::pair<size_t, size_t> > candidates = CandidatePairs();
+    std::sort(candidates.begin(), candidates.end());
+    vector<char> answers = polygons_.IntersectPairs(candidates, threads);
+    vector<std::pair<size_t, size_t> > result;
+    for (size_t q = 0; q < candidates.size(); ++q) {
+        if (answers[q]) {
+            result.push_back(candidates[q]);
+        }
+    }
+    return result;
+}
+
+ProximityTracker::ProximityTracker(const vector<Point>& sum) : sum_(sum), leaves_(1) {
+    size_t n = sum_.size();
+    for (size_t i = 0; i < n; ++i) {
+        Point edge = sum_[(i + 1) % n] - sum_[i];
+        double length = std::sqrt(edge.GetX() * edge.GetX() + edge.GetY() * edge.GetY());
+        normals_.emplace_back(edge.GetY() / length, -edge.GetX() / length);
+        support_.push_back(normals_[i].GetX() * sum_[i].GetX() + normals_[i].GetY() * sum_[i].GetY());
+    }
+    while (leaves_ < n) {
+        leaves_ *= 2;
+    }
+    min_support_.assign(2 * leaves_, INFINITY);
+    std::copy(support_.begin(), support_.end(), min_support_.begin() + leaves_);
+    for (size_t node = leaves_ - 1; node > 0; --node) {
+        min_support_[node] = std::min(min_support_[2 * node], min_support_[2 * node + 1]);
+    }
+    last_ = PointProximity(sum_, Point());
+}
+
+Proximity ProximityTracker::Query(const Point& shift) {
+    /* shift - сдвиг A относительно B с момента построения S.
+     */
+    Point point(-shift.GetX(), -shift.GetY());
+    if (sum_.size() < 3) {
+        return last_ = PointProximity(sum_, point);
+    }
+    Proximity result;
+    if (!last_.intersect && WalkOutside(last_.edge, point, result)) {
+        return last_ = result;
+    }
+    int nearest = last_.edge;
+    double distance = LineDistance(nearest, point);
+    SearchNearestLine(1, 0, leaves_, point, nearest, distance);
+    if (distance >= 0) {
+        Proximity inside = {true, distance, Point(-normals_[nearest].GetX(), -normals_[nearest].GetY()), nearest};
+        return last_ = inside;
+    }
+    // point правее прямой ребра nearest, и обход от него всегда заканчивается ответом.
+    if (WalkOutside(nearest, point, result)) {
+        return last_ = result;
+    }
+    return last_ = PointProximity(sum_, point);
+}
+
+bool ProximityTracker::WalkOutside(int edge, const Point& point, Proximity& result) const {
+    int n = sum_.size();
+    for (int step = 0; step < n; ++step) {
+        const Point& first = sum_[edge];
+        const Point& last = sum_[(edge + 1) % n];
+        if (InsideDistance(first, last, point) >= 0) {
+            return false;
+        }
+        double t = EdgeProjection(first, last, point);
+        if (t < 0) {
+            int previous = (edge + n - 1) % n;
+            if (EdgeProjection(sum_[previous], first, point) >= 1) {
+                result = EdgeProximity(sum_, edge, point);
+                return true;
+            }
+            edge = previous;
+        } else if (t > 1) {
+            int next = (edge + 1) % n;
+            if (EdgeProjection(last, sum_[(next + 1) % n], point) <= 0) {
+                result = EdgeProximity(sum_, edge, point);
+                return true;
+            }
+            edge = next;
+        } else {
+            result = EdgeProximity(sum_, edge, point);
+            return true;
+        }
+    }
+    return false;
+}
+
+double ProximityTracker::MaxNormalProjection(size_t first, size_t last, const Point& point) const {
+    /* Верхняя граница (normals_[j], point) для j из [first, last]. Если дуга нормалей меньше PI
+     * и направление point вне нее, максимум достигается на конце дуги, иначе берется |point|.
+     */
+    const Point& low = normals_[first];
+    const Point& high = normals_[last];
+    double low_projection = low.GetX() * point.GetX() + low.GetY() * point.GetY();
+    if (first == last) {
+        return low_projection;
+    }
+    double high_projection = high.GetX() * point.GetX() + high.GetY() * point.GetY();
+    bool short_arc = low.GetX() * high.GetY() - low.GetY() * high.GetX() > 0;
+    bool after_low = low.GetX() * point.GetY() - low.GetY() * point.GetX() >= 0;
+    bool before_high = point.GetX() * high.GetY() - point.GetY() * high.GetX() >= 0;
+    if (short_arc && !(after_low && before_high)) {
+        return std::max(low_projection, high_projection);
+    }
+    return std::sqrt(point.GetX() * point.GetX() + point.GetY() * point.GetY());
+}
+
+void ProximityTracker::SearchNearestLine(size_t node, size_t begin, size_t end, const Point& point,
+                                         int& nearest, double& distance) const {
+    /* Узел node покрывает ребра [begin, end); ветвь отбрасывается, если нижняя граница
+     * расстояния в ней не меньше найденного.
+     */
+    size_t n = sum_.size();
+    if (begin >= n) {
+        return;
+    }
+    double bound = min_support_[node] - MaxNormalProjection(begin, std::min(end, n) - 1, point);
+    if (bound >= distance) {
+        return;
+    }
+    if (end - begin == 1) {
+        nearest = begin;
+        distance = bound;
+        return;
+    }
+    size_t middle = (begin + end) / 2;
+    SearchNearestLine(2 * node, begin, middle, point, nearest, distance);
+    SearchNearestLine(2 * node + 1, middle, end, point, nearest, distance);
+}
+
+ConvexRegion::ConvexRegion(const vector<Point>& polygon, Kernel kernel)
+        : ConvexRegion(polygon, kernel, LinearEdgeLimit(kernel)) {}
+
+ConvexRegion::ConvexRegion(const vector<Point>& polygon, Kernel kernel, size_t linear_edge_limit)
+        : polygon_(polygon), kernel_(kernel), fan_(polygon.size() > linear_edge_limit), exact_(true) {
+    size_t n = polygon.size();
+    for (size_t i = 0; i < n; ++i) {
+        Point edge = polygon[i + 1 == n ? 0 : i + 1] - polygon[i];
+        origin_x_.push_back(polygon[i].GetX());
+        origin_y_.push_back(polygon[i].GetY());
+        edge_x_.push_back(edge.GetX());
+        edge_y_.push_back(edge.GetY());
+        if (!IsExactCoordinate(polygon[i].GetX()) || !IsExactCoordinate(polygon[i].GetY())) {
+            exact_ = false;
+        }
+    }
+}
+
+ConvexRegion::Kernel ConvexRegion::BestKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        return kAvx2Kernel;
+    }
+#endif
+    return kScalarKernel;
+}
+
+size_t ConvexRegion::LinearEdgeLimit(Kernel kernel) {
+    /* Число ребер, до которого линейный перебор быстрее веера (по замерам --bench на точках,
+     * половина которых внутри): скалярный цикл обгоняет веер примерно до 100 ребер, AVX2 - до 320.
+     */
+    return kernel == kAvx2Kernel ? 320 : 96;
+}
+
+bool ConvexRegion::Contains(const Point& point) const {
+    if (fan_) {
+        return ContainsFan(point.GetX(), point.GetY());
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (kernel_ == kAvx2Kernel) {
+        return ContainsAvx2(point.GetX(), point.GetY());
+    }
+#endif
+    return ContainsScalar(point.GetX(), point.GetY(), 0);
+}
+
+void ConvexRegion::Classify(const double* xs, const double* ys, size_t count, char* inside) const {
+    /* inside[k] - лежит ли точка (xs[k], ys[k]) в многоугольнике. Каждая точка проверяется
+     * отдельно: вариант, где регистр держит несколько точек и перебирает ребра, пока все они не
+     * окажутся снаружи, по замерам медленнее - блок ждет свою самую глубокую точку.
+     */
+    for (size_t k = 0; k < count; ++k) {
+        inside[k] = Contains(Point(xs[k], ys[k]));
+    }
+}
+
+bool ConvexRegion::ContainsScalar(double x, double y, size_t begin) const {
+    for (size_t i = begin; i < edge_x_.size(); ++i) {
+        double product = edge_x_[i] * (y - origin_y_[i]) - (x - origin_x_[i]) * edge_y_[i];
+        if (product < -EPS || (product <= EPS && !EdgeAdmits(i, x, y))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ConvexRegion::ContainsFan(double x, double y) const {
+    Arithmetic arithmetic = exact_ && IsExactCoordinate(x) && IsExactCoordinate(y) ? kExactInteger : kFloating;
+    return ConvexPolygonContains([this](int k) {
+        return polygon_[k];
+    }, polygon_.size(), Point(x, y), arithmetic);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+bool ConvexRegion::ContainsAvx2(double x, double y) const {
+    const __m256d point_x = _mm256_set1_pd(x);
+    const __m256d point_y = _mm256_set1_pd(y);
+    const __m256d eps = _mm256_set1_pd(EPS);
+    const __m256d minus_eps = _mm256_set1_pd(-EPS);
+    // Восемь ребер за итерацию: одна проверка знака на два регистра.
+    size_t i = 0;
+    for (; i + 8 <= edge_x_.size(); i += 8) {
+        __m256d low = _mm256_sub_pd(
+                _mm256_mul_pd(_mm256_loadu_pd(&edge_x_[i]), _mm256_sub_pd(point_y, _mm256_loadu_pd(&origin_y_[i]))),
+                _mm256_mul_pd(_mm256_sub_pd(point_x, _mm256_loadu_pd(&origin_x_[i])), _mm256_loadu_pd(&edge_y_[i])));
+        __m256d high = _mm256_sub_pd(
+                _mm256_mul_pd(_mm256_loadu_pd(&edge_x_[i + 4]), _mm256_sub_pd(point_y, _mm256_loadu_pd(&origin_y_[i + 4]))),
+                _mm256_mul_pd(_mm256_sub_pd(point_x, _mm256_loadu_pd(&origin_x_[i + 4])), _mm256_loadu_pd(&edge_y_[i + 4])));
+        if (_mm256_movemask_pd(_mm256_or_pd(_mm256_cmp_pd(low, minus_eps, _CMP_LT_OQ),
+                                            _mm256_cmp_pd(high, minus_eps, _CMP_LT_OQ))) != 0) {
+            return false;
+        }
+        int unsure = _mm256_movemask_pd(_mm256_cmp_pd(low, eps, _CMP_LE_OQ))
+                     | _mm256_movemask_pd(_mm256_cmp_pd(high, eps, _CMP_LE_OQ)) << 4;
+        for (; unsure != 0; unsure &= unsure - 1) {
+            if (!EdgeAdmits(i + __builtin_ctz(unsure), x, y)) {
+                return false;
+            }
+        }
+    }
+    return ContainsScalar(x, y, i);
+}
+#endif
+
+/* Замеры для --bench. Многоугольники и точки строятся xorshift-генератором с фиксированным зерном,
+ * координаты целые, так что прогоны повторяемы; время - по steady_clock, одно измерение на ячейку.
+ */
+template <class Function>
+double Seconds(Function function) {
+    auto begin = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+double BenchRandom(uint64_t& seed) {
+    /* Равномерно в [0, 1). */
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed >> 11) * (1.0 / 9007199254740992.0);
+}
+
+vector<Point> BenchPolygon(size_t vertices, double radius, const Point& center, uint64_t& seed) {
+    /* Выпуклый многоугольник против часовой стрелки от нижней вершины (как ConvexHull): вершины
+     * на окружности со случайными углами, округленные до целых. Округление может сделать часть
+     * вершин невыпуклыми, их отбрасывает ConvexHull.
+     */
+    vector<Point> points;
+    for (size_t k = 0; k < vertices; ++k) {
+        double angle = 2 * PI * (k + 0.5 * BenchRandom(seed)) / vertices;
+        points.emplace_back(std::round(center.GetX() + radius * std::cos(angle)),
+                            std::round(center.GetY() + radius * std::sin(angle)));
+    }
+    return ConvexHull(points, 1, kExactInteger);
+}
+
+vector<Point> Reflected(const vector<Point>& polygon) {
+    vector<Point> reflected;
+    for (const Point& vertex : polygon) {
+        reflected.emplace_back(-vertex.GetX(), -vertex.GetY());
+    }
+    return ConvexHull(reflected, 1, kExactInteger);
+}
+
+int RunBenchmarks(unsigned int threads) {
+    /* sum - MinkowskiSum в double и в точной арифметике; hull - ConvexHull по числу потоков;
+     * queries - пересечение пар малых и больших многоугольников разными способами;
+     * broad phase - сколько пар отсеивают прямоугольники при N от 10^4 до 10^6, время всего поиска
+     * пересекающихся пар и обновления после сдвига;
+     * kernels - ConvexRegion: линейный перебор с каждым ядром, доступным процессору, против веера;
+     * tracker - ProximityTracker на малых сдвигах против PointProximity с нуля.
+     */
+    cout << std::fixed << std::setprecision(4);
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+    cout << "sum: two polygons of 10^6 vertices\n";
+    {
+        vector<Point> first = BenchPolygon(1000000, 1e12, Point(), seed);
+        vector<Point> second = Reflected(BenchPolygon(1000000, 1e12, Point(5e11, 0), seed));
+        size_t floating_size = 0, exact_size = 0;
+        double floating = Seconds([&]() {
+            floating_size = MinkowskiSum(first, second, kFloating).size();
+        });
+        double exact = Seconds([&]() {
+            exact_size = MinkowskiSum(first, second, kExactInteger).size();
+        });
+        cout << "  " << first.size() << " + " << second.size() << " vertices: kFloating " << floating
+             << " s, kExactInteger " << exact << " s" << (floating_size == exact_size ? "" : "  MISMATCH") << "\n";
+    }
+
+    cout << "\nhull: 4 * 10^6 random points in a disk\n";
+    {
+        vector<Point> points;
+        for (size_t k = 0; k < 4000000; ++k) {
+            double radius = 1e9 * std::sqrt(BenchRandom(seed));
+            double angle = 2 * PI * BenchRandom(seed);
+            points.emplace_back(std::round(radius * std::cos(angle)), std::round(radius * std::sin(angle)));
+        }
+        double single = 0;
+        size_t single_size = 0;
+        for (unsigned int count = 1; count <= threads;
+             count = count * 2 > threads && count < threads ? threads : count * 2) {
+            size_t size = 0;
+            double elapsed = Seconds([&]() {
+                size = ConvexHull(points, count, kExactInteger).size();
+            });
+            if (count == 1) {
+                single = elapsed;
+                single_size = size;
+            }
+            cout << "  " << std::setw(3) << count << " threads " << elapsed << " s, speedup " << single / elapsed
+                 << ", " << size << " vertices" << (size == single_size ? "" : "  MISMATCH") << "\n";
+        }
+    }
+
+    cout << "\nqueries: us per query, sort + MinkowskiSum + PointBelongsToPolygon / IntersectByMerge / Intersect\n";
+    struct QuerySet {
+        const char* name;
+        size_t polygons;
+        size_t min_vertices;
+        size_t max_vertices;
+        size_t queries;
+    };
+    const QuerySet query_sets[] = {{"10^4 polygons of 8..32 vertices", 10000, 8, 32, 200000},
+                                   {"200 polygons of 5000..20000 vertices", 200, 5000, 20000, 2000}};
+    for (const QuerySet& query_set : query_sets) {
+        PolygonSet polygons;
+        vector<vector<Point> > clockwise;
+        for (size_t k = 0; k < query_set.polygons; ++k) {
+            size_t vertices = query_set.min_vertices
+                    + static_cast<size_t>(BenchRandom(seed) * (query_set.max_vertices - query_set.min_vertices + 1));
+            double radius = 1e6 * (1 + BenchRandom(seed));
+            Point center(std::round(4e6 * BenchRandom(seed)), std::round(4e6 * BenchRandom(seed)));
+            clockwise.push_back(BenchPolygon(vertices, radius, center, seed));
+            std::reverse(clockwise.back().begin(), clockwise.back().end());
+            polygons.Add(clockwise.back());
+        }
+        vector<std::pair<size_t, size_t> > pairs;
+        for (size_t q = 0; q < query_set.queries; ++q) {
+            pairs.emplace_back(static_cast<size_t>(BenchRandom(seed) * query_set.polygons),
+                               static_cast<size_t>(BenchRandom(seed) * query_set.polygons));
+        }
+        vector<char> sorted_answers, merge_answers, fan_answers;
+        double sorted = Seconds([&]() {
+            for (const std::pair<size_t, size_t>& pair : pairs) {
+                vector<Point> second;
+                for (const Point& vertex : clockwise[pair.second]) {
+                    second.emplace_back(-vertex.GetX(), -vertex.GetY());
+                }
+                vector<Point> sum = MinkowskiSum(SortVertices(clockwise[pair.first]), SortVertices(second), kExactInteger);
+                sorted_answers.push_back(PointBelongsToPolygon(Point(), sum));
+            }
+        });
+        double merge = Seconds([&]() {
+            for (const std::pair<size_t, size_t>& pair : pairs) {
+                merge_answers.push_back(polygons.IntersectByMerge(pair.first, pair.second));
+            }
+        });
+        double fan = Seconds([&]() {
+            fan_answers = polygons.IntersectPairs(pairs, 1);
+        });
+        size_t intersecting = std::count(fan_answers.begin(), fan_answers.end(), 1);
+        double scale = 1e6 / pairs.size();
+        cout << "  " << query_set.name << ", " << pairs.size() << " pairs (" << intersecting << " intersect): "
+             << sorted * scale << " / " << merge * scale << " / " << fan * scale
+             << (sorted_answers == fan_answers ? "" : "  sort path differs")
+             << (merge_answers == fan_answers ? "" : "  MISMATCH") << "\n";
+        for (unsigned int count = 2; count <= threads;
+             count = count * 2 > threads && count < threads ? threads : count * 2) {
+            double elapsed = Seconds([&]() {
+                polygons.IntersectPairs(pairs, count);
+            });
+            cout << "    IntersectPairs, " << count << " threads: " << elapsed * scale << " us, speedup "
+                 << fan / elapsed << "\n";
+        }
+    }
+
+    cout << "\nbroad phase: polygons of 8..16 vertices at a fixed density, N from 10^4 to 10^6\n";
+    const size_t counts[] = {10000, 100000, 1000000};
+    for (size_t count : counts) {
+        // Та же плотность, что у 20000 многоугольников в квадрате 10^6 x 10^6.
+        double side = 1e6 * std::sqrt(count / 20000.0);
+        PolygonSet polygons;
+        for (size_t k = 0; k < count; ++k) {
+            Point center(std::round(side * BenchRandom(seed)), std::round(side * BenchRandom(seed)));
+            vector<Point> polygon = BenchPolygon(8 + static_cast<size_t>(9 * BenchRandom(seed)),
+                                                 1000 + 4000 * BenchRandom(seed), center, seed);
+            std::reverse(polygon.begin(), polygon.end());
+            polygons.Add(polygon);
+        }
+        size_t candidates = 0, intersecting = 0;
+        std::unique_ptr<BroadPhase> broad_phase;
+        double build_time = Seconds([&]() {
+            broad_phase.reset(new BroadPhase(polygons));
+        });
+        double candidate_time = Seconds([&]() {
+            candidates = broad_phase->CandidatePairs().size();
+        });
+        double end_to_end = Seconds([&]() {
+            intersecting = BroadPhase(polygons).IntersectingPairs(threads).size();
+        });
+        // Все пары через точную проверку не прогнать; их время оценивается по 10^5 случайным парам.
+        vector<std::pair<size_t, size_t> > sample;
+        for (size_t q = 0; q < 100000; ++q) {
+            sample.emplace_back(static_cast<size_t>(BenchRandom(seed) * count),
+                                static_cast<size_t>(BenchRandom(seed) * count));
+        }
+        double sample_time = Seconds([&]() {
+            polygons.IntersectPairs(sample, threads);
+        });
+        double all_pairs = count * (count - 1) / 2.0;
+        cout << "  N = " << std::setw(7) << count << ": " << candidates << " candidates of " << static_cast<size_t>(all_pairs)
+             << " pairs (pruned " << std::setprecision(4) << 100 * (1 - candidates / all_pairs) << "%), "
+             << intersecting << " intersect\n"
+             << "    BroadPhase " << build_time << " s, CandidatePairs " << candidate_time
+             << " s, end to end " << end_to_end << " s; all pairs exactly ~"
+             << std::setprecision(0) << sample_time / sample.size() * all_pairs << std::setprecision(4) << " s\n";
+        for (size_t k = 0; k < count / 100; ++k) {
+            size_t polygon = static_cast<size_t>(BenchRandom(seed) * count);
+            polygons.Translate(polygon, Point(std::round(2000 * BenchRandom(seed)) - 1000,
+                                              std::round(2000 * BenchRandom(seed)) - 1000));
+            broad_phase->Update(polygon);
+        }
+        double update_time = Seconds([&]() {
+            candidates = broad_phase->CandidatePairs().size();
+        });
+        size_t rebuilt_candidates = 0;
+        double rebuild_time = Seconds([&]() {
+            BroadPhase rebuilt(polygons);
+            rebuilt_candidates = rebuilt.CandidatePairs().size();
+        });
+        cout << "    after moving 1%: Update + CandidatePairs " << update_time << " s, new BroadPhase "
+             << rebuild_time << " s" << (candidates == rebuilt_candidates ? "" : "  MISMATCH") << "\n";
+    }
+
+    cout << "\nkernels: ns per point over 10^6 points, linear scan per kernel / fan search, and Classify\n";
+    {
+        const size_t count = 1000000;
+        vector<double> xs(count), ys(count);
+        for (size_t k = 0; k < count; ++k) {
+            xs[k] = std::round(2.4e6 * BenchRandom(seed)) - 1.2e6;
+            ys[k] = std::round(2.4e6 * BenchRandom(seed)) - 1.2e6;
+        }
+        const size_t sizes[] = {8, 32, 96, 128, 320, 512, 1000};
+        const char* names[] = {"scalar", "avx2"};
+        for (size_t vertices : sizes) {
+            vector<Point> polygon = BenchPolygon(vertices, 1e6, Point(), seed);
+            vector<char> reference(count), answers(count);
+            auto contains_seconds = [&](const ConvexRegion& region) {
+                return Seconds([&]() {
+                    for (size_t k = 0; k < count; ++k) {
+                        answers[k] = region.Contains(Point(xs[k], ys[k]));
+                    }
+                });
+            };
+            cout << "  " << std::setw(4) << polygon.size() << " vertices:";
+            bool same = true;
+            for (int kernel = ConvexRegion::kScalarKernel; kernel <= ConvexRegion::BestKernel(); ++kernel) {
+                double linear = contains_seconds(ConvexRegion(polygon, static_cast<ConvexRegion::Kernel>(kernel), SIZE_MAX));
+                if (kernel == ConvexRegion::kScalarKernel) {
+                    reference = answers;
+                }
+                same = same && answers == reference;
+                cout << ' ' << names[kernel] << ' ' << linear * 1e9 / count;
+            }
+            double fan = contains_seconds(ConvexRegion(polygon, ConvexRegion::kScalarKernel, 0));
+            same = same && answers == reference;
+            ConvexRegion chosen(polygon);
+            double batch = Seconds([&]() {
+                chosen.Classify(xs.data(), ys.data(), count, answers.data());
+            });
+            same = same && answers == reference;
+            cout << ", fan " << fan * 1e9 / count << "; Classify " << batch * 1e9 / count << " ("
+                 << (polygon.size() > ConvexRegion::LinearEdgeLimit(ConvexRegion::BestKernel())
+                     ? "fan" : names[ConvexRegion::BestKernel()]) << ")" << (same ? "" : "  MISMATCH") << "\n";
+        }
+    }
+
+    cout << "\ntracker: 10^5 small shifts, ProximityTracker / PointProximity\n";
+    {
+        const size_t sizes[] = {100, 10000};
+        for (size_t vertices : sizes) {
+            vector<Point> first = BenchPolygon(vertices, 1e6, Point(), seed);
+            vector<Point> second = Reflected(BenchPolygon(vertices, 1e6, Point(1.5e6, 0), seed));
+            vector<Point> sum = MinkowskiSum(first, second, kExactInteger);
+            vector<Point> shifts;
+            Point shift;
+            for (size_t k = 0; k < 100000; ++k) {
+                shift = shift + Point(std::round(2000 * BenchRandom(seed)) - 1000, std::round(2000 * BenchRandom(seed)) - 1000);
+                shifts.push_back(shift);
+            }
+            ProximityTracker tracker(sum);
+            double warm_sum = 0, cold_sum = 0;
+            double warm = Seconds([&]() {
+                for (const Point& current : shifts) {
+                    warm_sum += tracker.Query(current).distance;
+                }
+            });
+            double cold = Seconds([&]() {
+                for (const Point& current : shifts) {
+                    cold_sum += PointProximity(sum, Point(-current.GetX(), -current.GetY())).distance;
+                }
+            });
+            cout << "  " << sum.size() << "-vertex sum: " << warm << " s / " << cold << " s"
+                 << (std::fabs(warm_sum - cold_sum) <= 1e-6 * std::fabs(cold_sum) ? "" : "  MISMATCH") << "\n";
+        }
+    }
+    return 0;
 }
@@ -6,146 +6,487 @@
  * автомат его подслов. Полученным автоматом будем обрабатывать слово с каждой позиции слова dfs-ом. Для того, чтобы
  * не пройти по циклу из эпсилон-ребер храним матрицу visited[text_position][state_index], показывающую пришли ли мы
  * в состояние state_index из позиции text_position
+ * Основной способ (ProcessWord) - один проход по слову с симуляцией множества состояний в духе Томпсона:
+ * для каждого активного состояния хранится самая ранняя позиция начала подслова, из которой оно достижимо.
+ * Пакетный режим: регулярное выражение со стандартного ввода, слова из файла, по ответу на строку.
+ * С ключом --dfa слова обрабатываются ленивым ДКА (LazyDfa), который кэширует шаги этой симуляции.
+ * "--bench [threads]" - замеры на синтетических выражениях и словах (RunBenchmarks), ввод не читается.
+ * Синтаксис выражения: любой байт, кроме операторов, - буква; \x - байт x как буква; [a-z0-9] и [^...] -
+ * класс байтов; 1 - пустое слово; + - объединение, . - конкатенация, * - звезда Клини, ^ - одно и более
+ * повторений (α^+), ? - необязательное вхождение. Буквенное ребро помечено номером класса байтов.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <set>
 #include <stack>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 using namespace std;
 
+struct CharClass {
+    /** Множество байтов, 256 бит.
+     */
+    uint64_t bits_[4];
+    CharClass() : bits_{0, 0, 0, 0} {}
+    explicit CharClass(unsigned char letter) : CharClass() {
+        Add(letter);
+    }
+    void Add(unsigned char letter) {
+        bits_[letter >> 6] |= uint64_t(1) << (letter & 63);
+    }
+    bool Contains(unsigned char letter) const {
+        return bits_[letter >> 6] >> (letter & 63) & 1;
+    }
+    void Invert() {
+        for (uint64_t &word : bits_) {
+            word = ~word;
+        }
+    }
+    bool Empty() const {
+        return (bits_[0] | bits_[1] | bits_[2] | bits_[3]) == 0;
+    }
+    bool operator < (const CharClass &other) const {
+        return lexicographical_compare(bits_, bits_ + 4, other.bits_, other.bits_ + 4);
+    }
+    string ToString() const {
+        string result;
+        for (int letter = 0; letter < 256; ++letter) {
+            if (Contains(letter)) {
+                result += static_cast<char>(letter);
+            }
+        }
+        return result.size() == 1 ? result : "[" + result + "]";
+    }
+};
+
 struct Edge {
+    /** Ребро при сборке автомата: letter_ - номер класса байтов в таблице автомата или kEpsilon для эпсилон-ребра.
+     */
+    static const int kEpsilon = -1;
+    int from_;
     int v_;
-    string letter_;
-    Edge(int to, string letter): v_(to), letter_(letter) {}
+    int letter_;
+    Edge(int from, int to, int letter): from_(from), v_(to), letter_(letter) {}
+};
+struct ReductionStats {
+    size_t vertices_before;
+    size_t edges_before;
+    size_t vertices_after;
+    size_t edges_after;
+};
+
+struct DfaStats {
+    size_t hits;
+    size_t misses;
+    size_t flushes;
+    size_t fallbacks;
 };
+
+struct WordScratch {
+    /** Рабочие массивы ProcessWord. Каждый поток держит свой экземпляр, чтобы слова одного потока
+     * не выделяли память заново, а сам автомат оставался только для чтения.
+     */
+    vector<uint64_t> active;
+    vector<int> order;
+    vector<int> earliest;
+    vector<int> stack_nodes;
+    vector<int> previous_order;
+    vector<int> previous_earliest;
+    vector<uint64_t> start_closure;
+};
+
 class AutomatonBuilder {
 private:
+    static const size_t kReduceWorkFactor = 16;
+    static const size_t kMaxClasses = 1 << 16;
+    /** Граф переходов хранится в сжатом построчном виде (CSR): буквенные ребра вершины i -
+     * letter_targets_[k], letter_labels_[k] для k из [letter_offsets_[i], letter_offsets_[i + 1]),
+     * эпсилон-ребра - eps_targets_[k] для k из [eps_offsets_[i], eps_offsets_[i + 1]).
+     * letter_labels_[k] - номер класса в classes_: ребро по классу одно, сколько бы байтов в нем ни было.
+     * Различных классов не больше kMaxClasses, поэтому номер помещается в 16 бит.
+     */
     size_t vertices_num_;
-    vector<vector<Edge> > transitions_;
+    vector<int> letter_offsets_;
+    vector<int> letter_targets_;
+    vector<uint16_t> letter_labels_;
+    vector<CharClass> classes_;
+    // class_members_[c * class_words_ + label / 64] - бит label % 64, если байт c входит в класс label.
+    size_t class_words_;
+    vector<uint64_t> class_members_;
+    vector<int> eps_offsets_;
+    vector<int> eps_targets_;
     vector<bool> terminals_;
+    // letter_sources_[c * ((vertices_num_ + 63) / 64) + i / 64] - бит i, если из i есть ребро по букве c.
+    vector<uint64_t> letter_sources_;
+    const uint64_t *ClassRow(unsigned char letter) const {
+        /** Строка битов классов, в которые входит letter: проверка ребра - один бит этой строки,
+         * без обращения к 32-байтовому CharClass.
+         */
+        return &class_members_[letter * class_words_];
+    }
+    static bool RowContains(const uint64_t *row, int label) {
+        return row[label / 64] >> (label % 64) & 1;
+    }
     int FindFirstBad(int node_index,
                      int position,
                      const string& word,
-                     vector< vector<bool> >& visited ) const {
+                     vector<uint64_t>& visited,
+                     vector<size_t>& touched,
+                     vector<pair<int, int> >& pending) const {
         /** Возвращает первую позицию, не входящую в подслово,
          * начинающееся с позиции position и состояния node_index
          * длина max_length будет пересчитываться по формуле first_bad(результат программы) - position.
+         * Обход идет по явному стеку pending пар (вершина, позиция), поэтому глубина не ограничена
+         * стеком вызовов. Пара (v, p) отмечается битом p * vertices_num_ + v в visited; номера
+         * поставленных битов копятся в touched, чтобы следующий запуск мог их снять.
          */
-        if( position == word.length() ) {
-            return position;
-        }
-        visited[position][node_index] = true;
         int result = position;
-        for (int j = 0; j < transitions_[node_index].size(); ++j) {
-            string new_letter = transitions_[node_index][j].letter_;
-            int new_v = transitions_[node_index][j].v_;
-            int new_position = (new_letter == "") ? position : position + 1;
+        auto visit = [&](int v, int p) {
+            size_t cell = static_cast<size_t>(p) * vertices_num_ + v;
+            uint64_t bit = uint64_t(1) << (cell & 63);
+            if (!(visited[cell >> 6] & bit)) {
+                visited[cell >> 6] |= bit;
+                touched.push_back(cell);
+                pending.push_back(make_pair(v, p));
+            }
+        };
+        visit(node_index, position);
+        while (!pending.empty()) {
+            int v = pending.back().first;
+            int p = pending.back().second;
+            pending.pop_back();
+            result = max(result, p);
+            if (p == word.length()) {
+                continue;
+            }
             // как видим, при переходе по эпсилон-ребру позиция текста не меняется.
-            if((new_letter == "" || new_letter == string({ word[position] })) &&
-               !visited[new_position][new_v]) {
-                result = max(result, FindFirstBad(new_v, new_position, word, visited));
+            for (int k = eps_offsets_[v]; k < eps_offsets_[v + 1]; ++k) {
+                visit(eps_targets_[k], p);
+            }
+            const uint64_t *row = ClassRow(static_cast<uint8_t>(word[p]));
+            for (int k = letter_offsets_[v]; k < letter_offsets_[v + 1]; ++k) {
+                if (RowContains(row, letter_labels_[k])) {
+                    visit(letter_targets_[k], p + 1);
+                }
             }
         }
         return result;
     }
+    void Pack(const vector<Edge> &edges) {
+        /** Раскладывает список ребер по строкам CSR подсчетом, за O(вершины + ребра).
+         * Метки ребер - номера в текущей classes_; одинаковые классы склеиваются, неиспользуемые выбрасываются.
+         * Для каждого байта строится строка битов классов, в которые он входит (class_members_).
+         */
+        map<CharClass, int> class_ids;
+        vector<CharClass> used_classes;
+        vector<int> class_remap(classes_.size(), -1);
+        for (const Edge &edge : edges) {
+            if (edge.letter_ != Edge::kEpsilon && class_remap[edge.letter_] == -1) {
+                auto inserted = class_ids.insert(make_pair(classes_[edge.letter_], static_cast<int>(used_classes.size())));
+                if (inserted.second) {
+                    used_classes.push_back(classes_[edge.letter_]);
+                }
+                class_remap[edge.letter_] = inserted.first->second;
+            }
+        }
+        classes_.swap(used_classes);
+        class_words_ = (classes_.size() + 63) / 64;
+        class_members_.assign(256 * class_words_, 0);
+        for (size_t label = 0; label < classes_.size(); ++label) {
+            for (int letter = 0; letter < 256; ++letter) {
+                if (classes_[label].Contains(letter)) {
+                    class_members_[letter * class_words_ + label / 64] |= uint64_t(1) << (label % 64);
+                }
+            }
+        }
+        letter_offsets_.assign(vertices_num_ + 1, 0);
+        eps_offsets_.assign(vertices_num_ + 1, 0);
+        for (const Edge &edge : edges) {
+            ++(edge.letter_ == Edge::kEpsilon ? eps_offsets_ : letter_offsets_)[edge.from_ + 1];
+        }
+        for (size_t i = 0; i < vertices_num_; ++i) {
+            letter_offsets_[i + 1] += letter_offsets_[i];
+            eps_offsets_[i + 1] += eps_offsets_[i];
+        }
+        letter_targets_.assign(letter_offsets_[vertices_num_], 0);
+        letter_labels_.assign(letter_offsets_[vertices_num_], 0);
+        eps_targets_.assign(eps_offsets_[vertices_num_], 0);
+        vector<int> letter_fill(letter_offsets_.begin(), letter_offsets_.end() - 1);
+        vector<int> eps_fill(eps_offsets_.begin(), eps_offsets_.end() - 1);
+        for (const Edge &edge : edges) {
+            if (edge.letter_ == Edge::kEpsilon) {
+                eps_targets_[eps_fill[edge.from_]++] = edge.v_;
+            } else {
+                letter_targets_[letter_fill[edge.from_]] = edge.v_;
+                letter_labels_[letter_fill[edge.from_]++] = class_remap[edge.letter_];
+            }
+        }
+        const size_t words = (vertices_num_ + 63) / 64;
+        letter_sources_.assign(256 * words, 0);
+        for (size_t i = 0; i < vertices_num_; ++i) {
+            for (int k = letter_offsets_[i]; k < letter_offsets_[i + 1]; ++k) {
+                const CharClass &letters = classes_[letter_labels_[k]];
+                for (int w = 0; w < 4; ++w) {
+                    for (uint64_t bits = letters.bits_[w]; bits != 0; bits &= bits - 1) {
+                        int letter = w * 64 + __builtin_ctzll(bits);
+                        letter_sources_[letter * words + i / 64] |= uint64_t(1) << (i % 64);
+                    }
+                }
+            }
+        }
+    }
+    void AppendEdges(vector<Edge> &edges, int shift, int class_shift = 0) const {
+        /** Дописывает в edges все ребра автомата, сдвинув номера вершин на shift, а номера классов на class_shift.
+         */
+        for (size_t i = 0; i < vertices_num_; ++i) {
+            for (int k = eps_offsets_[i]; k < eps_offsets_[i + 1]; ++k) {
+                edges.push_back(Edge(i + shift, eps_targets_[k] + shift, Edge::kEpsilon));
+            }
+            for (int k = letter_offsets_[i]; k < letter_offsets_[i + 1]; ++k) {
+                edges.push_back(Edge(i + shift, letter_targets_[k] + shift, letter_labels_[k] + class_shift));
+            }
+        }
+    }
+    struct RegexToken {
+        enum Kind {kLetters, kEpsilon, kUnary, kBinary};
+        Kind kind_;
+        char operator_;
+        CharClass letters_;
+    };
+    static bool ReadToken(const string &regex, size_t &i, RegexToken &token) {
+        /** Читает очередную лексему с позиции i и сдвигает i за нее. false - если лексема некорректна:
+         * обрыв после '\\', незакрытый или пустой класс, диапазон с концом меньше начала.
+         */
+        char symbol = regex[i++];
+        token.letters_ = CharClass();
+        switch (symbol) {
+            case '1':
+                token.kind_ = RegexToken::kEpsilon;
+                return true;
+            case '*':
+            case '^':
+            case '?':
+                token.kind_ = RegexToken::kUnary;
+                token.operator_ = symbol;
+                return true;
+            case '+':
+            case '.':
+                token.kind_ = RegexToken::kBinary;
+                token.operator_ = symbol;
+                return true;
+            case '\\':
+                if (i == regex.size()) {
+                    return false;
+                }
+                token.kind_ = RegexToken::kLetters;
+                token.letters_.Add(regex[i++]);
+                return true;
+            case '[':
+                break;
+            default:
+                token.kind_ = RegexToken::kLetters;
+                token.letters_.Add(symbol);
+                return true;
+        }
+        token.kind_ = RegexToken::kLetters;
+        bool negated = i < regex.size() && regex[i] == '^';
+        if (negated) {
+            ++i;
+        }
+        while (i < regex.size() && regex[i] != ']') {
+            if (regex[i] == '\\' && ++i == regex.size()) {
+                return false;
+            }
+            auto low = static_cast<unsigned char>(regex[i++]);
+            auto high = low;
+            if (i + 1 < regex.size() && regex[i] == '-' && regex[i + 1] != ']') {
+                if (regex[++i] == '\\' && ++i == regex.size()) {
+                    return false;
+                }
+                high = static_cast<unsigned char>(regex[i++]);
+            }
+            if (high < low) {
+                return false;
+            }
+            for (int letter = low; letter <= high; ++letter) {
+                token.letters_.Add(letter);
+            }
+        }
+        if (i == regex.size()) {
+            return false;
+        }
+        ++i;
+        if (negated) {
+            token.letters_.Invert();
+        }
+        return !token.letters_.Empty();
+    }
+    void BuildThompson(const string &regex) {
+        /** Построение Томпсона за O(|regex|): все фрагменты живут в общем списке ребер edges,
+         * фрагмент - пара (start, accept) номеров вершин. Операции не копируют фрагменты, а только
+         * добавляют новые вершины и эпсилон-ребра из accept операндов ("висячие" концы).
+         * Звезда - одна вершина-хаб, она же start и accept; ^ - хаб после accept с ребром назад в start;
+         * ? - новые start и accept: из start эпсилон-ребра в start операнда и в новый accept,
+         * из accept операнда - в новый accept. Класс байтов - одно ребро.
+         * В конце список ребер один раз раскладывается в CSR, стартовая вершина получает номер 0.
+         */
+        struct Fragment {
+            int start;
+            int accept;
+        };
+        vector<Edge> edges;
+        stack<Fragment> fragments;
+        classes_.clear();
+        int states = 0;
+        RegexToken token;
+        for (size_t i = 0; i < regex.size(); ) {
+            ReadToken(regex, i, token);
+            char symbol = token.operator_;
+            if (token.kind_ == RegexToken::kEpsilon) {
+                fragments.push({states, states});
+                ++states;
+            } else if (token.kind_ == RegexToken::kLetters) {
+                edges.push_back(Edge(states, states + 1, classes_.size()));
+                classes_.push_back(token.letters_);
+                fragments.push({states, states + 1});
+                states += 2;
+            } else if (token.kind_ == RegexToken::kUnary) {
+                Fragment inner = fragments.top();
+                fragments.pop();
+                if (symbol == '*') {
+                    edges.push_back(Edge(states, inner.start, Edge::kEpsilon));
+                    edges.push_back(Edge(inner.accept, states, Edge::kEpsilon));
+                    fragments.push({states, states});
+                } else if (symbol == '^') {
+                    edges.push_back(Edge(inner.accept, states, Edge::kEpsilon));
+                    edges.push_back(Edge(states, inner.start, Edge::kEpsilon));
+                    fragments.push({inner.start, states});
+                } else {
+                    // У accept операнда могут быть ребра назад (после ^), поэтому обход идет в новый accept.
+                    edges.push_back(Edge(states, inner.start, Edge::kEpsilon));
+                    edges.push_back(Edge(states, states + 1, Edge::kEpsilon));
+                    edges.push_back(Edge(inner.accept, states + 1, Edge::kEpsilon));
+                    fragments.push({states, states + 1});
+                    ++states;
+                }
+                ++states;
+            } else {
+                Fragment right = fragments.top();
+                fragments.pop();
+                Fragment left = fragments.top();
+                fragments.pop();
+                if (symbol == '+') {
+                    edges.push_back(Edge(states, left.start, Edge::kEpsilon));
+                    edges.push_back(Edge(states, right.start, Edge::kEpsilon));
+                    edges.push_back(Edge(left.accept, states + 1, Edge::kEpsilon));
+                    edges.push_back(Edge(right.accept, states + 1, Edge::kEpsilon));
+                    fragments.push({states, states + 1});
+                    states += 2;
+                } else {
+                    edges.push_back(Edge(left.accept, right.start, Edge::kEpsilon));
+                    fragments.push({left.start, right.accept});
+                }
+            }
+        }
+        Fragment whole = fragments.top();
+        auto renumber = [&whole](int v) {
+            return v == whole.start ? 0 : (v == 0 ? whole.start : v);
+        };
+        for (Edge &edge : edges) {
+            edge.from_ = renumber(edge.from_);
+            edge.v_ = renumber(edge.v_);
+        }
+        vertices_num_ = states;
+        terminals_.assign(states, false);
+        terminals_[renumber(whole.accept)] = true;
+        Pack(edges);
+    }
+    size_t EdgesNum() const {
+        return letter_targets_.size() + eps_targets_.size();
+    }
     bool ParsablePostfixRegex (const string &regex) {
-        /** Простая проверка корректности ввода
+        /** Простая проверка корректности ввода, различных классов байтов - не больше kMaxClasses.
          */
         int stack_size = 0;
-        int error = 0;
-        for (int i = 0; i < regex.length(); ++i) {
-            char current_char = regex[i];
-            switch (current_char) {
-                case '1':
-                case 'a':
-                case 'b':
-                case 'c':
+        RegexToken token;
+        set<CharClass> classes;
+        for (size_t i = 0; i < regex.length(); ) {
+            if (!ReadToken(regex, i, token)) {
+                return false;
+            }
+            switch (token.kind_) {
+                case RegexToken::kLetters:
+                    classes.insert(token.letters_);
+                    if (classes.size() > kMaxClasses) {
+                        return false;
+                    }
                     ++stack_size;
                     break;
-                case '*':
+                case RegexToken::kEpsilon:
+                    ++stack_size;
+                    break;
+                case RegexToken::kUnary:
                     if (stack_size == 0) {
-                        error = 1;
+                        return false;
                     }
                     break;
-                case '+':
-                case '.':
+                case RegexToken::kBinary:
                     if (stack_size < 2) {
-                        error = 1;
+                        return false;
                     }
                     --stack_size;
                     break;
-                default:
-                    error = 1;
-            }
-            if (error) {
-                return false;
             }
         }
         return (stack_size == 1);
     }
 public:
-    AutomatonBuilder() {}
-    AutomatonBuilder(char x):transitions_(vector<vector<Edge> >(2)), terminals_(vector<bool>(2)) {
+    AutomatonBuilder() : vertices_num_(0), class_words_(0) {}
+    AutomatonBuilder(char x) {
+        vector<Edge> edges;
         if (x == '1') {
             vertices_num_ = 1;
-            terminals_.pop_back();
-            terminals_[0] = true;
+            terminals_.assign(1, true);
         } else {
             vertices_num_ = 2;
-            string s = "";
-            s += x;
-            transitions_[0].push_back(Edge(1, s));
-            terminals_[0] = false;
+            classes_.push_back(CharClass(x));
+            edges.push_back(Edge(0, 1, 0));
+            terminals_.assign(2, false);
             terminals_[1] = true;
         }
+        Pack(edges);
     }
     AutomatonBuilder(string s) {
         if (!ParsablePostfixRegex(s)) {
             std::cout << "Wrong input format" << endl;
             vertices_num_ = 0;
         } else {
-            stack<AutomatonBuilder> st;
-            for (int i = 0; i < s.size(); ++i) {
-                if (s[i] == 'a' || s[i] == 'b' || s[i] == 'c' || s[i] == '1') {
-                    st.push(AutomatonBuilder(s[i]));
-                } else if (s[i] == '*') {
-                    AutomatonBuilder temp((st.top()).Star());
-                    st.pop();
-                    st.push(temp);
-                } else if (s[i] == '+') {
-                    AutomatonBuilder temp(st.top());
-                    st.pop();
-                    AutomatonBuilder temp2(st.top());
-                    st.pop();
-                    st.push(temp2 + temp);
-                } else if (s[i] == '.') {
-                    AutomatonBuilder temp(st.top());
-                    st.pop();
-                    AutomatonBuilder temp2(st.top());
-                    st.pop();
-                    st.push(temp2 * temp);
-                }
-            }
-            AutomatonBuilder other = st.top();
-            vertices_num_ = other.vertices_num_;
-            transitions_ = other.transitions_;
-            terminals_ = other.terminals_;
+            BuildThompson(s);
             //    print();
             FormSubstringsAutomaton();
         }
 
     }
 
-    AutomatonBuilder (unsigned int vertices_num, const vector< vector<Edge> >& transitions, vector<bool> terminals):
+    AutomatonBuilder (unsigned int vertices_num, const vector<Edge>& edges, vector<bool> terminals,
+                      const vector<CharClass>& classes):
             vertices_num_(vertices_num),
-            transitions_(transitions),
-            terminals_(terminals) {}
-    AutomatonBuilder (const AutomatonBuilder& other) {
-        vertices_num_ = other.vertices_num_;
-        transitions_ = other.transitions_;
-        terminals_ = other.terminals_;
+            classes_(classes),
+            terminals_(terminals) {
+        Pack(edges);
     }
 
     AutomatonBuilder operator + (const AutomatonBuilder& other) const {
@@ -153,31 +494,23 @@ public:
         * остальные ребра менять не будем. Добавятся два ребра.
         */
         std::size_t new_vertices_num = vertices_num_ + other.vertices_num_ + 1;
-        vector< vector<Edge> > new_transitions (new_vertices_num);
+        vector<Edge> new_edges;
         vector<bool> new_terminals(new_vertices_num);
 
-        new_transitions[0].push_back(Edge(1, ""));
-        new_transitions[0].push_back(Edge(vertices_num_ + 1, ""));
-
+        new_edges.push_back(Edge(0, 1, Edge::kEpsilon));
+        new_edges.push_back(Edge(0, vertices_num_ + 1, Edge::kEpsilon));
+        AppendEdges(new_edges, 1);
+        other.AppendEdges(new_edges, vertices_num_ + 1, classes_.size());
         for (int i = 0; i < vertices_num_; ++i) {
-            for (int j = 0; j < transitions_[i].size(); ++j) {
-                int new_v = transitions_[i][j].v_ + 1;
-                string new_letter = transitions_[i][j].letter_;
-                new_transitions[i + 1].push_back(Edge(new_v, new_letter));
-            }
             new_terminals[i + 1] = terminals_[i];
         }
         for (int i = 0; i < other.vertices_num_; ++i) {
-            int index = vertices_num_ + i + 1;
-            for (int j = 0; j < other.transitions_[i].size(); ++j) {
-                int new_v = other.transitions_[i][j].v_ + vertices_num_ + 1;
-                string new_letter = other.transitions_[i][j].letter_;
-                new_transitions[index].push_back(Edge(new_v, new_letter));
-            }
-            new_terminals[index] = other.terminals_[i];
+            new_terminals[vertices_num_ + i + 1] = other.terminals_[i];
         }
+        vector<CharClass> new_classes(classes_);
+        new_classes.insert(new_classes.end(), other.classes_.begin(), other.classes_.end());
 
-        return AutomatonBuilder(new_vertices_num, new_transitions, new_terminals);
+        return AutomatonBuilder(new_vertices_num, new_edges, new_terminals, new_classes);
     }
 
     AutomatonBuilder operator * (const AutomatonBuilder& other) const {
@@ -187,25 +520,23 @@ public:
          * того, что оно завершающее.
          */
         size_t new_vertices_num = vertices_num_ + other.vertices_num_;
-        vector< vector<Edge> > new_transitions (new_vertices_num);
+        vector<Edge> new_edges;
         vector<bool> new_terminals(new_vertices_num);
 
+        AppendEdges(new_edges, 0);
         for (int i = 0; i < vertices_num_; ++i) {
-            for (int j = 0; j < transitions_[i].size(); ++j) {
-                new_transitions[i].push_back(Edge(transitions_[i][j].v_, transitions_[i][j].letter_));
-            }
             new_terminals[i] = false;
             if (terminals_[i]) {
-                new_transitions[i].push_back(Edge(vertices_num_, ""));
+                new_edges.push_back(Edge(i, vertices_num_, Edge::kEpsilon));
             }
         }
+        other.AppendEdges(new_edges, vertices_num_, classes_.size());
         for (int i = 0; i < other.vertices_num_; ++i) {
-            for (int j = 0; j < other.transitions_[i].size(); ++j) {
-                new_transitions[vertices_num_ + i].push_back(Edge(other.transitions_[i][j].v_ + vertices_num_, other.transitions_[i][j].letter_));
-            }
             new_terminals[vertices_num_ + i] = other.terminals_[i];
         }
-        return AutomatonBuilder(new_vertices_num, new_transitions, new_terminals);
+        vector<CharClass> new_classes(classes_);
+        new_classes.insert(new_classes.end(), other.classes_.begin(), other.classes_.end());
+        return AutomatonBuilder(new_vertices_num, new_edges, new_terminals, new_classes);
     }
 
     AutomatonBuilder Star() const {
@@ -215,21 +546,19 @@ public:
          * в новую стартовую вершину.
          */
         size_t new_vertices_num = vertices_num_ + 1;
-        vector< vector<Edge> > new_transitions (new_vertices_num);
+        vector<Edge> new_edges;
         vector<bool> new_terminals(new_vertices_num);
         new_terminals[0] = true;
-        new_transitions[0].push_back(Edge(1, ""));
+        new_edges.push_back(Edge(0, 1, Edge::kEpsilon));
 
+        AppendEdges(new_edges, 1);
         for (int i = 0; i < vertices_num_; ++i) {
-            for (int j = 0; j < transitions_[i].size(); ++j) {
-                new_transitions[i + 1].push_back(Edge(transitions_[i][j].v_ + 1, transitions_[i][j].letter_));
-            }
             new_terminals[i + 1] = false;
             if (terminals_[i]) {
-                new_transitions[i + 1].push_back(Edge(0, ""));
+                new_edges.push_back(Edge(i + 1, 0, Edge::kEpsilon));
             }
         }
-        return AutomatonBuilder(new_vertices_num, new_transitions, new_terminals);
+        return AutomatonBuilder(new_vertices_num, new_edges, new_terminals, classes_);
     }
 
     void print() const {
@@ -243,12 +572,15 @@ public:
         std::cout << std::endl;
         std::cout << "transitions_ sizes: ";
         for (int i = 0; i < vertices_num_; ++i) {
-            std::cout << transitions_[i].size() << ' ';
+            std::cout << (eps_offsets_[i + 1] - eps_offsets_[i]) + (letter_offsets_[i + 1] - letter_offsets_[i]) << ' ';
         }
         std::cout << std::endl;
         for (int i = 0; i < vertices_num_; ++i) {
-            for (int j = 0; j < transitions_[i].size(); ++j) {
-                std::cout << i << " --> " << transitions_[i][j].v_ << "(" << transitions_[i][j].letter_ << ")" << std::endl;
+            for (int k = eps_offsets_[i]; k < eps_offsets_[i + 1]; ++k) {
+                std::cout << i << " --> " << eps_targets_[k] << "()" << std::endl;
+            }
+            for (int k = letter_offsets_[i]; k < letter_offsets_[i + 1]; ++k) {
+                std::cout << i << " --> " << letter_targets_[k] << "(" << classes_[letter_labels_[k]].ToString() << ")" << std::endl;
             }
         }
     }
@@ -260,39 +592,637 @@ public:
         size_t new_vertices_num = vertices_num_ + 2;
         vector<bool> new_terminals(new_vertices_num, false);
         new_terminals[new_vertices_num - 1] = true;
-        vector< vector<Edge> >  new_transitions(new_vertices_num);
+        vector<Edge> new_edges;
         for (int i = 0; i < vertices_num_; ++i) {
-            new_transitions[0].push_back(Edge(i + 1, ""));
-            new_transitions[i + 1].push_back(Edge(new_vertices_num - 1, ""));
-        }
-        for (int i = 0; i < vertices_num_; ++i) {
-            for (int j = 0; j < transitions_[i].size(); ++j) {
-                int new_v = transitions_[i][j].v_ + 1;
-                string new_letter = transitions_[i][j].letter_;
-                new_transitions[i + 1].push_back(Edge(new_v, new_letter));
-            }
+            new_edges.push_back(Edge(0, i + 1, Edge::kEpsilon));
+            new_edges.push_back(Edge(i + 1, new_vertices_num - 1, Edge::kEpsilon));
         }
+        AppendEdges(new_edges, 1);
         terminals_ = new_terminals;
-        transitions_ = new_transitions;
         vertices_num_= new_vertices_num;
+        Pack(new_edges);
     }
+    void MergeEpsilonForwarders();
+    ReductionStats Reduce();
+    int ProcessWord(const string &word_to_process) const;
+    int ProcessWord(const string &word_to_process, WordScratch &scratch) const;
+    vector<int> ProcessWords(const vector<string> &words, unsigned int threads, DfaStats *dfa_stats = nullptr) const;
+    int ProcessWordByDfs(const string &word_to_process) const;
+
+    friend class LazyDfa;
+};
+
+class LazyDfa {
+    /** Ленивый ДКА поверх автомата подслов, который помнит порядок начал подслов. Состояние ДКА -
+     * те же группы, что у AutomatonBuilder::ProcessWord: активные состояния НКА, разбитые по началу
+     * подслова и упорядоченные от раннего начала к позднему; сами позиции в состояние не входят.
+     * Переход table_[state * columns_ + column] хранит новое состояние, какие старые группы выжили и
+     * появилась ли группа начала со следующей позиции. Позиции начал групп держит ProcessWord в
+     * очереди: обычно гибнут самые старые группы, и очередь только теряет голову, иначе она
+     * пересобирается по списку выживших из plans_. Ответ в позиции - position + 1 минус начало первой
+     * группы, так что шаг - одно обращение к таблице, и слово не перечитывается.
+     * Состояние создается при первом переходе в него и ищется по хэшу. Если число состояний дошло до
+     * state_budget, кэш сбрасывается; если за одно слово сбросов больше kMaxFlushesPerWord, слово
+     * дообрабатывается симуляцией НКА (AutomatonBuilder::ProcessWord).
+     */
+public:
+    explicit LazyDfa(const AutomatonBuilder &automaton, size_t state_budget = 10000);
     int ProcessWord(const string &word_to_process);
 
+    DfaStats Stats() const {
+        return stats_;
+    }
+
+private:
+    static const int kStart = 0;
+    static const int kUnknown = -1;
+    static const int kMaxFlushesPerWord = 8;
+
+    struct Transition {
+        int next_;
+        // Если plan_ == kUnknown, выжили группы с номерами от dropped_ до конца, иначе - plans_[plan_].
+        int dropped_;
+        int plan_;
+        bool fresh_;
+    };
+
+    struct KeyHash {
+        size_t operator()(const vector<int> &key) const {
+            size_t hash = key.size();
+            for (int node : key) {
+                hash ^= std::hash<int>()(node) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+            }
+            return hash;
+        }
+    };
+
+    const AutomatonBuilder &automaton_;
+    size_t state_budget_;
+    int columns_;
+    vector<int> column_of_;
+    vector<unsigned char> letter_of_column_;
+    vector<int> start_closure_;
+    // keys_[state] - группы подряд, каждая - возрастающие номера состояний НКА и -1 в конце.
+    vector< vector<int> > keys_;
+    vector<int> groups_;
+    vector<Transition> table_;
+    vector< vector<int> > plans_;
+    unordered_map<vector<int>, int, KeyHash> ids_;
+    vector<bool> marked_;
+    DfaStats stats_;
+
+    void Flush();
+    int AddState(const vector<int> &key, int groups);
+    Transition Step(int state, int column);
 };
-int main() {
+
+bool ParseThreads(const string &text, unsigned int &threads) {
+    /** Число потоков - целое не меньше 1 без лишних символов; больше kMaxThreadsPerCore потоков
+     * на ядро пакетному режиму не нужно, такое число урезается.
+     */
+    const unsigned long kMaxThreadsPerCore = 4;
+    char *end;
+    long value = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || value < 1) {
+        return false;
+    }
+    unsigned long limit = kMaxThreadsPerCore * max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned int>(min<unsigned long>(value, limit));
+    return true;
+}
+
+int RunBenchmarks(unsigned int threads);
+
+int main(int argc, char *argv[]) {
+    /** Ключ "--dfa" (в любом месте) - обрабатывать слова ленивым ДКА (LazyDfa) вместо симуляции НКА;
+     * счетчики его кэша печатаются в stderr.
+     */
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        unsigned int threads = max(1u, std::thread::hardware_concurrency());
+        if (argc > 2 && !ParseThreads(argv[2], threads)) {
+            std::cerr << "Bad thread count " << argv[2] << std::endl;
+            return 1;
+        }
+        return RunBenchmarks(threads);
+    }
+    bool lazy_dfa = false;
+    vector<string> arguments;
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) == "--dfa") {
+            lazy_dfa = true;
+        } else {
+            arguments.push_back(argv[i]);
+        }
+    }
     string s, pattern;
-    std::cin >> s >> pattern;
+    std::cin >> s;
     AutomatonBuilder D(s);
-    int answer = D.ProcessWord(pattern);
+    ReductionStats stats = D.Reduce();
+    std::cerr << "states " << stats.vertices_before << " -> " << stats.vertices_after
+              << ", edges " << stats.edges_before << " -> " << stats.edges_after << std::endl;
+    DfaStats dfa_stats = {0, 0, 0, 0};
+    auto print_dfa_stats = [&dfa_stats]() {
+        std::cerr << "dfa hits " << dfa_stats.hits << ", misses " << dfa_stats.misses << ", flushes "
+                  << dfa_stats.flushes << ", fallbacks " << dfa_stats.fallbacks << std::endl;
+    };
+    /** Пакетный режим: "words_file [threads]". Автомат строится один раз, слова читаются пачками
+     * по kBatchSize и обрабатываются всеми потоками, ответы печатаются по одному на строку в порядке слов.
+     */
+    if (!arguments.empty()) {
+        std::ifstream input(arguments[0]);
+        if (!input) {
+            std::cerr << "Cannot read " << arguments[0] << std::endl;
+            return 1;
+        }
+        unsigned int threads = std::thread::hardware_concurrency();
+        if (arguments.size() > 1 && !ParseThreads(arguments[1], threads)) {
+            std::cerr << "Bad thread count " << arguments[1] << std::endl;
+            return 1;
+        }
+        const size_t kBatchSize = 1 << 16;
+        vector<string> batch;
+        while (input) {
+            batch.clear();
+            while (batch.size() < kBatchSize && input >> pattern) {
+                batch.push_back(pattern);
+            }
+            for (int answer : D.ProcessWords(batch, threads, lazy_dfa ? &dfa_stats : nullptr)) {
+                std::cout << answer << '\n';
+            }
+        }
+        if (lazy_dfa) {
+            print_dfa_stats();
+        }
+        return 0;
+    }
+    std::cin >> pattern;
+    int answer;
+    if (lazy_dfa) {
+        LazyDfa dfa(D);
+        answer = dfa.ProcessWord(pattern);
+        dfa_stats = dfa.Stats();
+        print_dfa_stats();
+    } else {
+        answer = D.ProcessWord(pattern);
+    }
     std::cout << "answer is " << answer << std::endl;
 }
 //acb..bab.c.*.ab.ba.+.+*a. cbaa
 //ab+c.aba.*.bac.+.+* babc
-int AutomatonBuilder::ProcessWord(const string &word_to_process) {
-    /** Функция для нахождения ответа. Осуществляется дфс-ом FindFirstBad(node, text_position, word, visited
+int AutomatonBuilder::ProcessWord(const string &word_to_process) const {
+    WordScratch scratch;
+    return ProcessWord(word_to_process, scratch);
+}
+
+int AutomatonBuilder::ProcessWord(const string &word_to_process, WordScratch &scratch) const {
+    /** Функция для нахождения ответа за один проход по слову, O(|word| * (вершины + ребра)) времени
+     * и O(вершины + ребра) памяти.
+     * Активные состояния хранятся битовым множеством active и списком order, упорядоченным по earliest -
+     * самой ранней позиции начала подслова, прочитав которое от начала, можно оказаться в состоянии.
+     * Переход по букве обходит order по возрастанию earliest, поэтому каждое состояние впервые
+     * помечается минимальным началом. После перехода добавляются состояния эпсилон-замыкания старта
+     * (новое подслово с текущей позиции). Ответ - максимум position - earliest первого в order.
+     * Маски состояний, из которых есть ребро по каждой букве, считаются при упаковке (letter_sources_),
+     * эпсилон-замыкание старта - в начале слова. Массивы берутся из scratch и переиспользуются между словами.
+     */
+    if (vertices_num_ == 0) {
+        std::cout << "Wrong input" << std::endl;
+        return -1;
+    }
+    const size_t words = (vertices_num_ + 63) / 64;
+    vector<uint64_t> &active = scratch.active;
+    vector<int> &order = scratch.order;
+    vector<int> &earliest = scratch.earliest;
+    vector<int> &stack_nodes = scratch.stack_nodes;
+    active.assign(words, 0);
+    order.clear();
+    earliest.assign(vertices_num_, 0);
+    stack_nodes.clear();
+    auto mark = [&](int node, int start) {
+        /** Помечает node и его эпсилон-замыкание началом start, уже помеченные состояния не трогает.
+         */
+        if (active[node / 64] >> (node % 64) & 1) {
+            return;
+        }
+        active[node / 64] |= uint64_t(1) << (node % 64);
+        earliest[node] = start;
+        order.push_back(node);
+        stack_nodes.push_back(node);
+        while (!stack_nodes.empty()) {
+            int v = stack_nodes.back();
+            stack_nodes.pop_back();
+            for (int k = eps_offsets_[v]; k < eps_offsets_[v + 1]; ++k) {
+                int u = eps_targets_[k];
+                if (!(active[u / 64] >> (u % 64) & 1)) {
+                    active[u / 64] |= uint64_t(1) << (u % 64);
+                    earliest[u] = start;
+                    order.push_back(u);
+                    stack_nodes.push_back(u);
+                }
+            }
+        }
+    };
+    mark(0, 0);
+    vector<uint64_t> &start_closure = scratch.start_closure;
+    start_closure = active;
+
+    int max_length = 0;
+    vector<int> &previous_order = scratch.previous_order;
+    vector<int> &previous_earliest = scratch.previous_earliest;
+    previous_order.clear();
+    previous_earliest.assign(vertices_num_, 0);
+    size_t word_length = word_to_process.length();
+    for (int position = 0; position < word_length; ++position) {
+        auto letter = static_cast<unsigned char>(word_to_process[position]);
+        const uint64_t *sources = &letter_sources_[letter * words];
+        const uint64_t *row = ClassRow(letter);
+        previous_order.swap(order);
+        previous_earliest.swap(earliest);
+        order.clear();
+        active.assign(words, 0);
+        for (int v : previous_order) {
+            if (!(sources[v / 64] >> (v % 64) & 1)) {
+                continue;
+            }
+            for (int k = letter_offsets_[v]; k < letter_offsets_[v + 1]; ++k) {
+                if (RowContains(row, letter_labels_[k])) {
+                    mark(letter_targets_[k], previous_earliest[v]);
+                }
+            }
+        }
+        if (!order.empty()) {
+            max_length = max(max_length, position + 1 - earliest[order[0]]);
+        }
+        // Подслова, начинающиеся со следующей позиции: состояния замыкания старта, еще не помеченные.
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t fresh = start_closure[w] & ~active[w];
+            while (fresh != 0) {
+                int node = w * 64 + __builtin_ctzll(fresh);
+                fresh &= fresh - 1;
+                active[w] |= uint64_t(1) << (node % 64);
+                earliest[node] = position + 1;
+                order.push_back(node);
+            }
+        }
+    }
+    return max_length;
+}
+
+vector<int> AutomatonBuilder::ProcessWords(const vector<string> &words, unsigned int threads, DfaStats *dfa_stats) const {
+    /** Ответы для пачки слов в порядке входа. Автомат не меняется, поэтому потоки читают его без
+     * синхронизации; слова раздаются по одному через атомарный счетчик, чтобы длинные слова не
+     * задерживали весь отрезок, у каждого потока свой WordScratch.
+     * Если dfa_stats не nullptr, слова обрабатываются ленивым ДКА (свой кэш у каждого потока),
+     * а счетчики кэшей прибавляются к *dfa_stats.
+     */
+    vector<int> answers(words.size(), -1);
+    if (vertices_num_ == 0) {
+        std::cout << "Wrong input" << std::endl;
+        return answers;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    std::atomic<size_t> next(0);
+    vector<DfaStats> thread_stats(threads, DfaStats{0, 0, 0, 0});
+    auto work = [&](unsigned int thread) {
+        if (dfa_stats != nullptr) {
+            LazyDfa dfa(*this);
+            for (size_t i = next++; i < words.size(); i = next++) {
+                answers[i] = dfa.ProcessWord(words[i]);
+            }
+            thread_stats[thread] = dfa.Stats();
+            return;
+        }
+        WordScratch scratch;
+        for (size_t i = next++; i < words.size(); i = next++) {
+            answers[i] = ProcessWord(words[i], scratch);
+        }
+    };
+    vector<std::thread> workers;
+    for (unsigned int t = 1; t < threads; ++t) {
+        workers.emplace_back(work, t);
+    }
+    work(0);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    if (dfa_stats != nullptr) {
+        for (const DfaStats &stats : thread_stats) {
+            dfa_stats->hits += stats.hits;
+            dfa_stats->misses += stats.misses;
+            dfa_stats->flushes += stats.flushes;
+            dfa_stats->fallbacks += stats.fallbacks;
+        }
+    }
+    return answers;
+}
+
+void AutomatonBuilder::MergeEpsilonForwarders() {
+    /** Склейка эпсилон-переходников за O(вершины + ребра) на проход, язык и множество подслов не меняются.
+     * Вершина v вливается в w, если у v есть эпсилон-ребро в w, каждое другое ребро v есть и у w
+     * (с тем же концом с точностью до склейки), и v завершающая только вместе с w: после склейки
+     * из объединенной вершины выходят ровно ребра w, а v и так переходила в w по эпсилону.
+     * Так пропадают вершины-связки Томпсона (конец левого операнда конкатенации, концы ветвей
+     * объединения), в том числе в автомате подслов, где у всех вершин есть общее ребро в завершающую.
+     * Проверяются только вершины степени не больше kMaxDegree, поэтому проход линеен.
+     */
+    const int n = vertices_num_;
+    const size_t kMaxDegree = 8;
+    const int kMaxPasses = 4;
+    vector<vector<pair<int, int> > > out(n);
+    for (int v = 0; v < n; ++v) {
+        for (int k = eps_offsets_[v]; k < eps_offsets_[v + 1]; ++k) {
+            out[v].push_back(make_pair(static_cast<int>(Edge::kEpsilon), eps_targets_[k]));
+        }
+        for (int k = letter_offsets_[v]; k < letter_offsets_[v + 1]; ++k) {
+            out[v].push_back(make_pair(letter_labels_[k], letter_targets_[k]));
+        }
+    }
+    vector<int> parent(n);
+    for (int v = 0; v < n; ++v) {
+        parent[v] = v;
+    }
+    auto find = [&parent](int v) {
+        while (parent[v] != v) {
+            parent[v] = parent[parent[v]];
+            v = parent[v];
+        }
+        return v;
+    };
+    bool changed = true;
+    for (int pass = 0; pass < kMaxPasses && changed; ++pass) {
+        changed = false;
+        for (int v = 0; v < n; ++v) {
+            if (parent[v] != v || out[v].size() > kMaxDegree) {
+                continue;
+            }
+            for (const pair<int, int> &forward : out[v]) {
+                int w = find(forward.second);
+                if (forward.first != Edge::kEpsilon || w == v || out[w].size() > kMaxDegree ||
+                    (terminals_[v] && !terminals_[w])) {
+                    continue;
+                }
+                // Концы сравниваются так, как они будут выглядеть после склейки v с w.
+                auto merged = [&](int u) {
+                    u = find(u);
+                    return u == v ? w : u;
+                };
+                bool covered = true;
+                for (const pair<int, int> &edge : out[v]) {
+                    int target = merged(edge.second);
+                    if (edge.first == Edge::kEpsilon && target == w) {
+                        continue;
+                    }
+                    bool found = false;
+                    for (const pair<int, int> &other : out[w]) {
+                        if (other.first == edge.first && merged(other.second) == target) {
+                            found = true;
+                            break;
+                        }
+                    }
+                    if (!found) {
+                        covered = false;
+                        break;
+                    }
+                }
+                if (covered) {
+                    parent[v] = w;
+                    out[v].clear();
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Старт получает номер 0, остальные представители - подряд.
+    vector<int> id(n, -1);
+    int vertices = 0;
+    id[find(0)] = vertices++;
+    for (int v = 0; v < n; ++v) {
+        if (parent[v] == v && id[v] == -1) {
+            id[v] = vertices++;
+        }
+    }
+    if (vertices == n) {
+        return;
+    }
+    vector<bool> new_terminals(vertices, false);
+    vector<Edge> new_edges;
+    vector<pair<int, int> > edges;
+    for (int v = 0; v < n; ++v) {
+        if (parent[v] != v) {
+            continue;
+        }
+        new_terminals[id[v]] = terminals_[v];
+        edges.clear();
+        for (const pair<int, int> &edge : out[v]) {
+            int target = id[find(edge.second)];
+            if (edge.first != Edge::kEpsilon || target != id[v]) {
+                edges.push_back(make_pair(edge.first, target));
+            }
+        }
+        sort(edges.begin(), edges.end());
+        edges.erase(unique(edges.begin(), edges.end()), edges.end());
+        for (const pair<int, int> &edge : edges) {
+            new_edges.push_back(Edge(id[v], edge.second, edge.first));
+        }
+    }
+    vertices_num_ = vertices;
+    terminals_ = new_terminals;
+    Pack(new_edges);
+}
+
+ReductionStats AutomatonBuilder::Reduce() {
+    /** Упрощение автомата перед поиском, язык не меняется:
+     * 0. Склейка эпсилон-переходников (MergeEpsilonForwarders), линейная.
+     * 1. Удаление эпсилон-ребер: вершина q получает буквенные ребра всех вершин своего
+     *    эпсилон-замыкания и становится завершающей, если замыкание содержит завершающую.
+     * 2. Удаление вершин, недостижимых из старта, и вершин, из которых не достижима завершающая.
+     * 3. Склейка бисимулярных вершин: разбиение на классы уточняется, пока вершины одного класса
+     *    отличаются завершаемостью или множеством пар (метка, класс конца ребра).
+     * Старт остается вершиной 0. Замыкания вложенных звезд могут дать квадратичный объем, а
+     * уточнение разбиения - число раундов порядка длины автомата, поэтому шаги 1 и 3 ограничены
+     * kReduceWorkFactor * (вершины + ребра) каждый. Если шаг 1 не уложился, шаги 2 и 3 идут по
+     * эпсилон-НКА, где эпсилон - еще одна метка; если шаг 3 не уложился, вершины не склеиваются.
+     */
+    ReductionStats stats = {vertices_num_, EdgesNum(), vertices_num_, EdgesNum()};
+    if (vertices_num_ == 0) {
+        return stats;
+    }
+    MergeEpsilonForwarders();
+    const int n = vertices_num_;
+    const size_t work_limit = kReduceWorkFactor * (vertices_num_ + EdgesNum());
+    size_t work = 0;
+
+    // 1. Эпсилон-замыкания и новые буквенные ребра.
+    vector<vector<pair<int, int> > > letters(n);
+    vector<bool> finals(n, false);
+    vector<int> stamp(n, -1);
+    vector<int> stack_nodes;
+    for (int q = 0; q < n && work <= work_limit; ++q) {
+        stamp[q] = q;
+        stack_nodes.push_back(q);
+        while (!stack_nodes.empty()) {
+            int v = stack_nodes.back();
+            stack_nodes.pop_back();
+            work += 1 + letter_offsets_[v + 1] - letter_offsets_[v];
+            if (terminals_[v]) {
+                finals[q] = true;
+            }
+            for (int k = letter_offsets_[v]; k < letter_offsets_[v + 1]; ++k) {
+                letters[q].push_back(make_pair(letter_labels_[k], letter_targets_[k]));
+            }
+            for (int k = eps_offsets_[v]; k < eps_offsets_[v + 1]; ++k) {
+                if (stamp[eps_targets_[k]] != q) {
+                    stamp[eps_targets_[k]] = q;
+                    stack_nodes.push_back(eps_targets_[k]);
+                }
+            }
+        }
+        sort(letters[q].begin(), letters[q].end());
+        letters[q].erase(unique(letters[q].begin(), letters[q].end()), letters[q].end());
+    }
+    if (work > work_limit) {
+        for (int q = 0; q < n; ++q) {
+            letters[q].clear();
+            finals[q] = terminals_[q];
+            for (int k = eps_offsets_[q]; k < eps_offsets_[q + 1]; ++k) {
+                letters[q].push_back(make_pair(static_cast<int>(Edge::kEpsilon), eps_targets_[k]));
+            }
+            for (int k = letter_offsets_[q]; k < letter_offsets_[q + 1]; ++k) {
+                letters[q].push_back(make_pair(letter_labels_[k], letter_targets_[k]));
+            }
+        }
+    }
+
+    // 2. Достижимые из старта и полезные вершины.
+    vector<bool> reachable(n, false);
+    reachable[0] = true;
+    stack_nodes.push_back(0);
+    vector<vector<int> > reverse_edges(n);
+    while (!stack_nodes.empty()) {
+        int v = stack_nodes.back();
+        stack_nodes.pop_back();
+        for (const pair<int, int> &edge : letters[v]) {
+            reverse_edges[edge.second].push_back(v);
+            if (!reachable[edge.second]) {
+                reachable[edge.second] = true;
+                stack_nodes.push_back(edge.second);
+            }
+        }
+    }
+    vector<bool> alive(n, false);
+    for (int q = 0; q < n; ++q) {
+        if (reachable[q] && finals[q]) {
+            alive[q] = true;
+            stack_nodes.push_back(q);
+        }
+    }
+    while (!stack_nodes.empty()) {
+        int v = stack_nodes.back();
+        stack_nodes.pop_back();
+        for (int u : reverse_edges[v]) {
+            if (!alive[u]) {
+                alive[u] = true;
+                stack_nodes.push_back(u);
+            }
+        }
+    }
+    alive[0] = true;
+
+    // 3. Бисимуляция: уточнение разбиения до неподвижной точки.
+    vector<int> block(n, -1);
+    for (int q = 0; q < n; ++q) {
+        if (alive[q]) {
+            block[q] = finals[q] ? 1 : 0;
+        }
+    }
+    size_t blocks_num = 0;
+    work = 0;
+    while (true) {
+        if (work > work_limit) {
+            blocks_num = 0;
+            for (int q = 0; q < n; ++q) {
+                block[q] = alive[q] ? static_cast<int>(blocks_num++) : -1;
+            }
+            break;
+        }
+        map<vector<int>, int> signatures;
+        vector<int> new_block(n, -1);
+        for (int q = 0; q < n; ++q) {
+            if (!alive[q]) {
+                continue;
+            }
+            // Пары (метка, класс) сортируются и повторы удаляются, чтобы сравнивать множества.
+            vector<pair<int, int> > pairs;
+            for (const pair<int, int> &edge : letters[q]) {
+                if (alive[edge.second]) {
+                    pairs.push_back(make_pair(edge.first, block[edge.second]));
+                }
+            }
+            sort(pairs.begin(), pairs.end());
+            pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+            work += 1 + pairs.size();
+            vector<int> signature(1, block[q]);
+            for (const pair<int, int> &item : pairs) {
+                signature.push_back(item.first);
+                signature.push_back(item.second);
+            }
+            auto inserted = signatures.insert(make_pair(signature, static_cast<int>(signatures.size())));
+            new_block[q] = inserted.first->second;
+        }
+        block.swap(new_block);
+        if (signatures.size() == blocks_num) {
+            break;
+        }
+        blocks_num = signatures.size();
+    }
+
+    // Класс старта получает номер 0, ребра между классами без повторов.
+    int start_block = block[0];
+    auto renumber = [start_block](int b) {
+        return b == start_block ? 0 : (b == 0 ? start_block : b);
+    };
+    vector<bool> new_terminals(blocks_num, false);
+    vector<bool> done(blocks_num, false);
+    vector<Edge> new_edges;
+    for (int q = 0; q < n; ++q) {
+        if (!alive[q] || done[block[q]]) {
+            continue;
+        }
+        int from = renumber(block[q]);
+        done[block[q]] = true;
+        new_terminals[from] = finals[q];
+        vector<pair<int, int> > pairs;
+        for (const pair<int, int> &edge : letters[q]) {
+            if (alive[edge.second]) {
+                pairs.push_back(make_pair(edge.first, renumber(block[edge.second])));
+            }
+        }
+        sort(pairs.begin(), pairs.end());
+        pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+        for (const pair<int, int> &item : pairs) {
+            new_edges.push_back(Edge(from, item.second, item.first));
+        }
+    }
+    vertices_num_ = blocks_num;
+    terminals_ = new_terminals;
+    Pack(new_edges);
+    stats.vertices_after = vertices_num_;
+    stats.edges_after = EdgesNum();
+    return stats;
+}
+
+int AutomatonBuilder::ProcessWordByDfs(const string &word_to_process) const {
+    /** Исходный способ нахождения ответа, за O(|word|^2 * вершины); оставлен для проверки ProcessWord.
+     * Осуществляется обходом FindFirstBad(node, text_position, word, ...)
      * по ходу выполнения обновляем результат max_length
-     * visited[text_position][state_index] хранит true/false в зависимости от того, пришли ли мы в состояние под номером
-     * state_index, запустив слово с позиции text_position. Это помогает не заходить в циклы из эпсилон ребер
+     * Бит text_position * vertices_num_ + state_index в visited показывает, пришли ли мы в состояние
+     * state_index на позиции text_position при текущем старте. Это помогает не заходить в циклы из
+     * эпсилон ребер. Битовая карта выделяется один раз на слово; перед следующим стартом снимаются
+     * только биты из touched, так что сброс стоит столько же, сколько сам обход.
      * text_position обновляется если переход осуществлен по текущей букве word[text_position] слова word
      */
     if (vertices_num_ == 0) {
@@ -301,20 +1231,386 @@ int AutomatonBuilder::ProcessWord(const string &word_to_process) {
     }
     int max_length = 0;
     size_t word_length = word_to_process.length();
+    vector<uint64_t> visited(((word_length + 1) * vertices_num_ + 63) / 64, 0);
+    vector<size_t> touched;
+    vector<pair<int, int> > pending;
     for (int s = 0; s < word_length; ++s) {
-        vector <bool> visited_nodes(vertices_num_, false);
-        vector < vector<bool> > visited;
-        visited.assign(word_length + 1, visited_nodes);
-        // Заполним все сразу
-        for (int k = 0; k <= word_length; ++k) {
-            for (int i = 0; i < vertices_num_; ++i) {
-                visited[k][i] = false;
+        int temp_res = FindFirstBad(0, s, word_to_process, visited, touched, pending) - s;
+        max_length = max(max_length, temp_res);
+        for (size_t cell : touched) {
+            visited[cell >> 6] &= ~(uint64_t(1) << (cell & 63));
+        }
+        touched.clear();
+    }
+
+    return max_length;
+}
+
+LazyDfa::LazyDfa(const AutomatonBuilder &automaton, size_t state_budget)
+        : automaton_(automaton),
+          state_budget_(max(state_budget, size_t(2))),
+          columns_(1),
+          column_of_(256, 0),
+          marked_(automaton.vertices_num_, false),
+          stats_({0, 0, 0, 0}) {
+    /** Столбец - класс эквивалентности байтов: байты, входящие в одни и те же классы автомата, ведут
+     * себя одинаково. Разбиение уточняется каждым классом; столбец 0 - байты вне всех классов.
+     */
+    for (const CharClass &letters : automaton_.classes_) {
+        map<pair<int, bool>, int> split;
+        split[make_pair(0, false)] = 0;
+        int next_column = 1;
+        for (int letter = 0; letter < 256; ++letter) {
+            auto inserted = split.insert(make_pair(make_pair(column_of_[letter], letters.Contains(letter)), next_column));
+            if (inserted.second) {
+                ++next_column;
             }
+            column_of_[letter] = inserted.first->second;
         }
-        int temp_res = FindFirstBad(0, s, word_to_process, visited) - s;
-        max_length = max(max_length, temp_res);
-        //    cout << "ml" << max_length;
+        columns_ = next_column;
+    }
+    letter_of_column_.assign(columns_, 0);
+    for (int letter = 0; letter < 256; ++letter) {
+        letter_of_column_[column_of_[letter]] = letter;
     }
+    if (automaton_.vertices_num_ > 0) {
+        vector<int> stack_nodes(1, 0);
+        marked_[0] = true;
+        while (!stack_nodes.empty()) {
+            int v = stack_nodes.back();
+            stack_nodes.pop_back();
+            start_closure_.push_back(v);
+            for (int k = automaton_.eps_offsets_[v]; k < automaton_.eps_offsets_[v + 1]; ++k) {
+                int u = automaton_.eps_targets_[k];
+                if (!marked_[u]) {
+                    marked_[u] = true;
+                    stack_nodes.push_back(u);
+                }
+            }
+        }
+        for (int v : start_closure_) {
+            marked_[v] = false;
+        }
+        sort(start_closure_.begin(), start_closure_.end());
+    }
+    Flush();
+    stats_.flushes = 0;
+}
 
+void LazyDfa::Flush() {
+    ++stats_.flushes;
+    keys_.clear();
+    groups_.clear();
+    table_.clear();
+    plans_.clear();
+    ids_.clear();
+    vector<int> start(start_closure_);
+    start.push_back(-1);
+    AddState(start, 1);
+}
+
+int LazyDfa::AddState(const vector<int> &key, int groups) {
+    int id = keys_.size();
+    keys_.push_back(key);
+    groups_.push_back(groups);
+    table_.resize(table_.size() + columns_, Transition{kUnknown, 0, kUnknown, false});
+    ids_[key] = id;
+    return id;
+}
+
+LazyDfa::Transition LazyDfa::Step(int state, int column) {
+    /** Переход строится так же, как шаг AutomatonBuilder::ProcessWord: группы обходятся от ранних
+     * к поздним, и состояние НКА достается первой группе, которая в него попала.
+     */
+    Transition cached = table_[state * columns_ + column];
+    if (cached.next_ != kUnknown) {
+        ++stats_.hits;
+        return cached;
+    }
+    ++stats_.misses;
+    const vector<int> key = keys_[state];
+    const int old_groups = groups_[state];
+    const uint64_t *row = automaton_.ClassRow(letter_of_column_[column]);
+    vector<int> next_key;
+    vector<int> survivors;
+    vector<int> touched;
+    vector<int> stack_nodes;
+    size_t group_begin = 0;
+    int group = 0;
+    for (int v : key) {
+        if (v == -1) {
+            if (next_key.size() > group_begin) {
+                sort(next_key.begin() + group_begin, next_key.end());
+                next_key.push_back(-1);
+                survivors.push_back(group);
+            }
+            group_begin = next_key.size();
+            ++group;
+            continue;
+        }
+        if (column == 0) {
+            continue;
+        }
+        for (int k = automaton_.letter_offsets_[v]; k < automaton_.letter_offsets_[v + 1]; ++k) {
+            int u = automaton_.letter_targets_[k];
+            if (marked_[u] || !AutomatonBuilder::RowContains(row, automaton_.letter_labels_[k])) {
+                continue;
+            }
+            marked_[u] = true;
+            stack_nodes.push_back(u);
+            while (!stack_nodes.empty()) {
+                int w = stack_nodes.back();
+                stack_nodes.pop_back();
+                touched.push_back(w);
+                next_key.push_back(w);
+                for (int e = automaton_.eps_offsets_[w]; e < automaton_.eps_offsets_[w + 1]; ++e) {
+                    if (!marked_[automaton_.eps_targets_[e]]) {
+                        marked_[automaton_.eps_targets_[e]] = true;
+                        stack_nodes.push_back(automaton_.eps_targets_[e]);
+                    }
+                }
+            }
+        }
+    }
+    // Группа подслов, начинающихся со следующей позиции: еще не занятые состояния замыкания старта.
+    size_t fresh_begin = next_key.size();
+    for (int v : start_closure_) {
+        if (!marked_[v]) {
+            next_key.push_back(v);
+        }
+    }
+    for (int v : touched) {
+        marked_[v] = false;
+    }
+    Transition result = {kUnknown, old_groups, kUnknown, next_key.size() > fresh_begin};
+    if (result.fresh_) {
+        next_key.push_back(-1);
+    }
+    bool suffix = true;
+    for (size_t i = 0; i < survivors.size(); ++i) {
+        suffix = suffix && survivors[i] == old_groups - static_cast<int>(survivors.size() - i);
+    }
+    if (suffix) {
+        result.dropped_ = old_groups - survivors.size();
+    }
+    bool remember = true;
+    auto found = ids_.find(next_key);
+    if (found != ids_.end()) {
+        result.next_ = found->second;
+    } else {
+        if (keys_.size() >= state_budget_) {
+            // После сброса номер state недействителен, поэтому переход не запоминается.
+            Flush();
+            remember = false;
+        }
+        result.next_ = AddState(next_key, survivors.size() + result.fresh_);
+    }
+    if (!suffix) {
+        result.plan_ = plans_.size();
+        plans_.push_back(survivors);
+    }
+    if (remember) {
+        table_[state * columns_ + column] = result;
+    }
+    return result;
+}
+
+int LazyDfa::ProcessWord(const string &word_to_process) {
+    /** Тот же ответ, что у AutomatonBuilder::ProcessWord. starts - позиции начал групп текущего
+     * состояния в том же порядке, что и группы.
+     */
+    if (automaton_.vertices_num_ == 0) {
+        std::cout << "Wrong input" << std::endl;
+        return -1;
+    }
+    size_t flushes_before = stats_.flushes;
+    int max_length = 0;
+    int state = kStart;
+    deque<int> starts(1, 0);
+    vector<int> kept;
+    for (size_t position = 0; position < word_to_process.length(); ++position) {
+        Transition step = Step(state, column_of_[static_cast<unsigned char>(word_to_process[position])]);
+        if (step.plan_ == kUnknown) {
+            starts.erase(starts.begin(), starts.begin() + step.dropped_);
+        } else {
+            kept.clear();
+            for (int group : plans_[step.plan_]) {
+                kept.push_back(starts[group]);
+            }
+            starts.assign(kept.begin(), kept.end());
+        }
+        if (!starts.empty()) {
+            max_length = max(max_length, static_cast<int>(position + 1 - starts.front()));
+        }
+        if (step.fresh_) {
+            starts.push_back(position + 1);
+        }
+        state = step.next_;
+        if (stats_.flushes - flushes_before > kMaxFlushesPerWord) {
+            ++stats_.fallbacks;
+            return automaton_.ProcessWord(word_to_process);
+        }
+    }
     return max_length;
 }
+
+/** Замеры для --bench. Выражения и слова строятся xorshift-генератором с фиксированным зерном,
+ * так что прогоны повторяемы; время - по steady_clock, одно измерение на ячейку.
+ */
+template <class Function>
+double Seconds(Function function) {
+    auto begin = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+uint64_t NextRandom(uint64_t &seed) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+string BenchRegex(size_t letters, uint64_t seed) {
+    /** Случайное выражение в обратной польской записи над { a, b, c } примерно из letters букв:
+     * depth - число фрагментов в стеке, выражение замыкается, когда он сворачивается в один.
+     */
+    string regex;
+    size_t depth = 0, used = 0;
+    while (used < letters || depth > 1) {
+        uint64_t r = NextRandom(seed) % 100;
+        if (depth >= 2 && (r < 35 || used >= letters)) {
+            regex += "..+"[NextRandom(seed) % 3];
+            --depth;
+        } else if (depth >= 1 && r < 50) {
+            regex += "*?^"[NextRandom(seed) % 3];
+        } else {
+            regex += "abc"[NextRandom(seed) % 3];
+            ++depth;
+            ++used;
+        }
+    }
+    return regex;
+}
+
+string BenchWord(size_t length, const string &alphabet, uint64_t &seed) {
+    string word(length, alphabet[0]);
+    for (char &letter : word) {
+        letter = alphabet[NextRandom(seed) % alphabet.size()];
+    }
+    return word;
+}
+
+int RunBenchmarks(unsigned int threads) {
+    /** reduce - размер автомата подслов до и после Reduce и время сборки и сокращения;
+     * simulation - ProcessWord против LazyDfa на длинных словах, ProcessWordByDfs - на их концах;
+     * batch - ProcessWords по числу потоков, с ленивым ДКА и без;
+     * classes - класс [a-z] против объединения 26 букв в том же выражении.
+     */
+    std::cout << std::fixed << std::setprecision(4);
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+    std::cout << "reduce: states, edges before -> after, build s, Reduce s\n";
+    const size_t sizes[] = {300, 3000, 30000, 280000};
+    for (size_t letters : sizes) {
+        string regex = BenchRegex(letters, letters);
+        AutomatonBuilder automaton;
+        double build = Seconds([&]() {
+            automaton = AutomatonBuilder(regex);
+        });
+        ReductionStats stats;
+        double reduce = Seconds([&]() {
+            stats = automaton.Reduce();
+        });
+        std::cout << "  " << std::setw(6) << letters << " letters  " << stats.vertices_before << ", "
+                  << stats.edges_before << " -> " << stats.vertices_after << ", " << stats.edges_after
+                  << "  " << build << "  " << reduce << "\n";
+    }
+
+    std::cout << "\nsimulation: ProcessWord s / LazyDfa s, and ProcessWordByDfs s on a short word\n";
+    {
+        string long_run(32000, 'a');
+        long_run += 'b';
+        struct Case {
+            const char *regex;
+            string word;
+        };
+        const Case cases[] = {
+                {"ab+c+*", BenchWord(1 << 20, "abc", seed)},
+                {"a*b.", long_run + long_run + long_run + long_run},
+                {"ab.c.", BenchWord(1 << 20, "abc", seed)}};
+        for (const Case &test : cases) {
+            AutomatonBuilder automaton(test.regex);
+            automaton.Reduce();
+            int nfa_answer = 0, dfa_answer = 0, dfs_answer = 0;
+            double nfa = Seconds([&]() {
+                nfa_answer = automaton.ProcessWord(test.word);
+            });
+            LazyDfa dfa(automaton);
+            double lazy = Seconds([&]() {
+                dfa_answer = dfa.ProcessWord(test.word);
+            });
+            string short_word = test.word.substr(test.word.size() - 3000);
+            double dfs = Seconds([&]() {
+                dfs_answer = automaton.ProcessWordByDfs(short_word);
+            });
+            std::cout << "  " << std::setw(7) << test.regex << "  " << test.word.size() << " letters  " << nfa
+                      << " / " << lazy << " (" << dfa.Stats().misses << " misses), 3000 letters " << dfs
+                      << (nfa_answer == dfa_answer && dfs_answer == automaton.ProcessWord(short_word) ? "" : "  MISMATCH")
+                      << "\n";
+        }
+    }
+
+    std::cout << "\nbatch: 300-letter regex, 20000 words of 20..60 letters, NFA s / lazy DFA s\n";
+    {
+        AutomatonBuilder automaton(BenchRegex(300, 300));
+        automaton.Reduce();
+        vector<string> words;
+        for (size_t i = 0; i < 20000; ++i) {
+            words.push_back(BenchWord(20 + NextRandom(seed) % 41, "abc", seed));
+        }
+        double single = 0;
+        for (unsigned int count = 1; count <= threads;
+             count = count * 2 > threads && count < threads ? threads : count * 2) {
+            vector<int> nfa_answers, dfa_answers;
+            double nfa = Seconds([&]() {
+                nfa_answers = automaton.ProcessWords(words, count);
+            });
+            DfaStats dfa_stats = {0, 0, 0, 0};
+            double lazy = Seconds([&]() {
+                dfa_answers = automaton.ProcessWords(words, count, &dfa_stats);
+            });
+            if (count == 1) {
+                single = nfa;
+            }
+            std::cout << "  " << std::setw(3) << count << " threads  " << nfa << " / " << lazy
+                      << ", NFA speedup " << single / nfa << (nfa_answers == dfa_answers ? "" : "  MISMATCH") << "\n";
+        }
+    }
+
+    std::cout << "\nclasses: (X X .)* X over 1 MB of a..z, states after Reduce, build s, ProcessWord s\n";
+    {
+        string word = BenchWord(1 << 20, "abcdefghijklmnopqrstuvwxyz", seed);
+        string expanded = "a";
+        for (char letter = 'b'; letter <= 'z'; ++letter) {
+            expanded += string(1, letter) + "+";
+        }
+        const string variants[] = {"[a-z]", expanded};
+        for (const string &x : variants) {
+            string regex = x + x + ".*" + x + ".";
+            AutomatonBuilder classes;
+            ReductionStats stats;
+            double build = Seconds([&]() {
+                classes = AutomatonBuilder(regex);
+                stats = classes.Reduce();
+            });
+            int answer = 0;
+            double process = Seconds([&]() {
+                answer = classes.ProcessWord(word);
+            });
+            std::cout << "  " << (x.size() == 5 ? "class   " : "26-union") << "  " << stats.vertices_after << " states  "
+                      << build << "  " << process << "  answer " << answer << "\n";
+        }
+    }
+    return 0;
+}